@@ -0,0 +1,436 @@
+/* ColorConvert.h, copyright (c) 2014 Robert Xiao
+
+Converts packed 4:2:2 video (YUYV or UYVY) to RGB, BGR or RGBA, or extracts
+just its luma (Y) plane as 8-bit grayscale.
+
+Uses the same fixed-point formula as libuvc's uvc_yuyv2rgb/uvc_uyvy2rgb:
+    R = Y + (22987 * (V-128)) >> 14
+    G = Y + (-5636 * (U-128) - 11698 * (V-128)) >> 14
+    B = Y + (29049 * (U-128)) >> 14
+The SIMD kernels compute the chroma terms with 16x16->32 multiply-adds, so every
+kernel produces results bit-identical to the scalar path (and to libuvc).
+
+Kernels are templates over the source layout and destination order, and are
+picked once per conversion from a small table, so the inner loops don't branch
+on either.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "SIMD.h"
+
+class YUVConverter {
+public:
+    enum Layout {
+        LAYOUT_YUYV,
+        LAYOUT_UYVY,
+        NUM_LAYOUTS
+    };
+
+    enum Order {
+        ORDER_RGB,
+        ORDER_BGR,
+        ORDER_RGBA,
+        ORDER_LUMA, /* one byte per pixel: Y, with no colour conversion */
+        NUM_ORDERS
+    };
+
+    enum ISA {
+        ISA_SCALAR,
+        ISA_SSE2,
+        ISA_AVX2,
+        ISA_NEON
+    };
+
+    /* Convert one row of width pixels (width must be even) */
+    typedef void (*ConvertRowFn)(const uint8_t *src, uint8_t *dst, int width);
+
+private:
+    ISA isa;
+    ConvertRowFn kernels[NUM_LAYOUTS][NUM_ORDERS];
+
+public:
+    YUVConverter() {
+        ISA best = ISA_SCALAR;
+#if defined(GESTURECAM_HAVE_NEON)
+        best = ISA_NEON;
+#elif defined(GESTURECAM_HAVE_SSE2)
+        best = ISA_SSE2;
+#endif
+        if(cpuHasAVX2())
+            best = ISA_AVX2;
+        setISA(best);
+    }
+
+    /* Convert a width x height image; strides are in bytes */
+    void convert(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+            int width, int height, Layout layout, Order order) const {
+        ConvertRowFn fn = kernels[layout][order];
+        for(int y=0; y<height; y++)
+            fn(src + y * srcStride, dst + y * dstStride, width);
+    }
+
+    /* Override the instruction set, e.g. ISA_SCALAR to compare against the SIMD kernels.
+       Requests for an instruction set that was not compiled in fall back to scalar. */
+    void setISA(ISA newIsa) {
+        isa = newIsa;
+        fillKernels<LAYOUT_YUYV>();
+        fillKernels<LAYOUT_UYVY>();
+    }
+
+    ISA getISA() const {
+        return isa;
+    }
+
+    const char *getISAName() const {
+        switch(isa) {
+            case ISA_SSE2: return "SSE2";
+            case ISA_AVX2: return "AVX2";
+            case ISA_NEON: return "NEON";
+            default: return "scalar";
+        }
+    }
+
+private:
+    template <int L>
+    void fillKernels() {
+        kernels[L][ORDER_RGB] = selectKernel<L, ORDER_RGB>(isa);
+        kernels[L][ORDER_BGR] = selectKernel<L, ORDER_BGR>(isa);
+        kernels[L][ORDER_RGBA] = selectKernel<L, ORDER_RGBA>(isa);
+        kernels[L][ORDER_LUMA] = selectLumaKernel<L>(isa);
+    }
+
+    /* Luma extraction is pure data movement, so AVX2 gains nothing over SSE2 */
+    template <int L>
+    static ConvertRowFn selectLumaKernel(ISA isa) {
+        switch(isa) {
+#ifdef GESTURECAM_HAVE_SSE2
+            case ISA_SSE2:
+            case ISA_AVX2: return lumaRowSSE2<L>;
+#endif
+#ifdef GESTURECAM_HAVE_NEON
+            case ISA_NEON: return lumaRowNEON<L>;
+#endif
+            default: return lumaRowScalar<L>;
+        }
+    }
+
+    template <int L, int O>
+    static ConvertRowFn selectKernel(ISA isa) {
+        switch(isa) {
+#ifdef GESTURECAM_HAVE_SSE2
+            case ISA_SSE2: return convertRowSSE2<L, O>;
+#endif
+#ifdef GESTURECAM_HAVE_AVX2
+            case ISA_AVX2: return convertRowAVX2<L, O>;
+#endif
+#ifdef GESTURECAM_HAVE_NEON
+            case ISA_NEON: return convertRowNEON<L, O>;
+#endif
+            default: return convertRowScalar<L, O>;
+        }
+    }
+
+    static const int COEF_RV = 22987;
+    static const int COEF_GU = -5636;
+    static const int COEF_GV = -11698;
+    static const int COEF_BU = 29049;
+
+    static inline uint8_t saturate(int v) {
+        return (v < 0) ? 0 : (v > 255) ? 255 : v;
+    }
+
+    template <int O>
+    static inline void storePixel(uint8_t *px, int y, int r, int g, int b) {
+        px[(O == ORDER_BGR) ? 2 : 0] = saturate(y + r);
+        px[1] = saturate(y + g);
+        px[(O == ORDER_BGR) ? 0 : 2] = saturate(y + b);
+        if(O == ORDER_RGBA)
+            px[3] = 255;
+    }
+
+    /* Convert pixels [x, width) of a row; used for the tails of the SIMD kernels */
+    template <int L, int O>
+    static inline void convertPixelsScalar(const uint8_t *src, uint8_t *dst, int x, int width) {
+        const int bpp = (O == ORDER_RGBA) ? 4 : 3;
+        for(; x<width; x+=2) {
+            const uint8_t *yuv = src + 2*x;
+            int y0 = yuv[(L == LAYOUT_YUYV) ? 0 : 1];
+            int y1 = yuv[(L == LAYOUT_YUYV) ? 2 : 3];
+            int u = yuv[(L == LAYOUT_YUYV) ? 1 : 0] - 128;
+            int v = yuv[(L == LAYOUT_YUYV) ? 3 : 2] - 128;
+            int r = (COEF_RV * v) >> 14;
+            int g = (COEF_GU * u + COEF_GV * v) >> 14;
+            int b = (COEF_BU * u) >> 14;
+            storePixel<O>(dst + bpp*x, y0, r, g, b);
+            storePixel<O>(dst + bpp*(x+1), y1, r, g, b);
+        }
+    }
+
+    template <int L, int O>
+    static void convertRowScalar(const uint8_t *src, uint8_t *dst, int width) {
+        convertPixelsScalar<L, O>(src, dst, 0, width);
+    }
+
+    template <int L>
+    static inline void lumaPixelsScalar(const uint8_t *src, uint8_t *dst, int x, int width) {
+        const uint8_t *y = src + ((L == LAYOUT_YUYV) ? 0 : 1);
+        for(; x<width; x++)
+            dst[x] = y[2*x];
+    }
+
+    template <int L>
+    static void lumaRowScalar(const uint8_t *src, uint8_t *dst, int width) {
+        lumaPixelsScalar<L>(src, dst, 0, width);
+    }
+
+#ifdef GESTURECAM_HAVE_SSE2
+    /* Two int16 coefficients for _mm_madd_epi16 against (U, V) pairs */
+    static inline int coefPair(int cu, int cv) {
+        return (int)(((uint32_t)(uint16_t)cv << 16) | (uint16_t)cu);
+    }
+
+    /* Eight pixels (16 bytes) of YUV to int16 R, G, B */
+    template <int L>
+    static inline void yuvToRGB16SSE2(__m128i in, __m128i &r, __m128i &g, __m128i &b) {
+        const __m128i lowBytes = _mm_set1_epi16(0xff);
+        __m128i y, uv;
+        if(L == LAYOUT_YUYV) {
+            y = _mm_and_si128(in, lowBytes);
+            uv = _mm_srli_epi16(in, 8);
+        } else {
+            uv = _mm_and_si128(in, lowBytes);
+            y = _mm_srli_epi16(in, 8);
+        }
+        uv = _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+        /* One chroma term per pixel pair, then duplicated to both pixels */
+        __m128i rc = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_set1_epi32(coefPair(0, COEF_RV))), 14);
+        __m128i gc = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_set1_epi32(coefPair(COEF_GU, COEF_GV))), 14);
+        __m128i bc = _mm_srai_epi32(_mm_madd_epi16(uv, _mm_set1_epi32(coefPair(COEF_BU, 0))), 14);
+        rc = _mm_packs_epi32(rc, rc);
+        gc = _mm_packs_epi32(gc, gc);
+        bc = _mm_packs_epi32(bc, bc);
+        r = _mm_add_epi16(y, _mm_unpacklo_epi16(rc, rc));
+        g = _mm_add_epi16(y, _mm_unpacklo_epi16(gc, gc));
+        b = _mm_add_epi16(y, _mm_unpacklo_epi16(bc, bc));
+    }
+
+    /* Store 16 pixels given as u8 channel vectors. 24-bit orders write one byte
+       past the 16th pixel, so the caller must leave room after them. */
+    template <int O>
+    static inline void storePixelsSSE2(uint8_t *dst, __m128i r, __m128i g, __m128i b) {
+        if(O == ORDER_BGR) {
+            __m128i t = r;
+            r = b;
+            b = t;
+        }
+        __m128i a = _mm_set1_epi8((char)0xff);
+        __m128i rg0 = _mm_unpacklo_epi8(r, g);
+        __m128i rg1 = _mm_unpackhi_epi8(r, g);
+        __m128i ba0 = _mm_unpacklo_epi8(b, a);
+        __m128i ba1 = _mm_unpackhi_epi8(b, a);
+        __m128i px[4] = {
+            _mm_unpacklo_epi16(rg0, ba0),
+            _mm_unpackhi_epi16(rg0, ba0),
+            _mm_unpacklo_epi16(rg1, ba1),
+            _mm_unpackhi_epi16(rg1, ba1)
+        };
+        if(O == ORDER_RGBA) {
+            for(int i=0; i<4; i++)
+                _mm_storeu_si128((__m128i *)(dst + 16*i), px[i]);
+        } else {
+            /* Overlapping 4-byte stores, each overwriting the previous pixel's alpha */
+            for(int i=0; i<4; i++) {
+                __m128i v = px[i];
+                for(int j=0; j<4; j++) {
+                    int32_t word = _mm_cvtsi128_si32(v);
+                    memcpy(dst + 3*(4*i + j), &word, 4);
+                    v = _mm_srli_si128(v, 4);
+                }
+            }
+        }
+    }
+
+    template <int L, int O>
+    static void convertRowSSE2(const uint8_t *src, uint8_t *dst, int width) {
+        const int bpp = (O == ORDER_RGBA) ? 4 : 3;
+        /* 24-bit stores spill one byte, so they stop one block early */
+        const int end = (O == ORDER_RGBA) ? width : width - 1;
+        int x = 0;
+        for(; x + 16 <= end; x += 16) {
+            __m128i r0, g0, b0, r1, g1, b1;
+            yuvToRGB16SSE2<L>(_mm_loadu_si128((const __m128i *)(src + 2*x)), r0, g0, b0);
+            yuvToRGB16SSE2<L>(_mm_loadu_si128((const __m128i *)(src + 2*x + 16)), r1, g1, b1);
+            storePixelsSSE2<O>(dst + bpp*x, _mm_packus_epi16(r0, r1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(b0, b1));
+        }
+        convertPixelsScalar<L, O>(src, dst, x, width);
+    }
+
+    template <int L>
+    static void lumaRowSSE2(const uint8_t *src, uint8_t *dst, int width) {
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+        int x = 0;
+        for(; x + 16 <= width; x += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + 2*x));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + 2*x + 16));
+            if(L == LAYOUT_YUYV) {
+                a = _mm_and_si128(a, mask);
+                b = _mm_and_si128(b, mask);
+            } else {
+                a = _mm_srli_epi16(a, 8);
+                b = _mm_srli_epi16(b, 8);
+            }
+            _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(a, b));
+        }
+        lumaPixelsScalar<L>(src, dst, x, width);
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_AVX2
+    /* Sixteen pixels (32 bytes) of YUV to int16 R, G, B; each 128-bit lane holds eight pixels */
+    template <int L>
+    GESTURECAM_TARGET_AVX2
+    static inline void yuvToRGB16AVX2(__m256i in, __m256i &r, __m256i &g, __m256i &b) {
+        const __m256i lowBytes = _mm256_set1_epi16(0xff);
+        __m256i y, uv;
+        if(L == LAYOUT_YUYV) {
+            y = _mm256_and_si256(in, lowBytes);
+            uv = _mm256_srli_epi16(in, 8);
+        } else {
+            uv = _mm256_and_si256(in, lowBytes);
+            y = _mm256_srli_epi16(in, 8);
+        }
+        uv = _mm256_sub_epi16(uv, _mm256_set1_epi16(128));
+
+        __m256i rc = _mm256_srai_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32(coefPair(0, COEF_RV))), 14);
+        __m256i gc = _mm256_srai_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32(coefPair(COEF_GU, COEF_GV))), 14);
+        __m256i bc = _mm256_srai_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32(coefPair(COEF_BU, 0))), 14);
+        rc = _mm256_packs_epi32(rc, rc);
+        gc = _mm256_packs_epi32(gc, gc);
+        bc = _mm256_packs_epi32(bc, bc);
+        r = _mm256_add_epi16(y, _mm256_unpacklo_epi16(rc, rc));
+        g = _mm256_add_epi16(y, _mm256_unpacklo_epi16(gc, gc));
+        b = _mm256_add_epi16(y, _mm256_unpacklo_epi16(bc, bc));
+    }
+
+    /* Store 16 pixels given as u8 channel vectors. 24-bit orders write four bytes
+       past the 16th pixel, so the caller must leave room after them. */
+    template <int O>
+    GESTURECAM_TARGET_AVX2
+    static inline void storePixelsAVX2(uint8_t *dst, __m128i r, __m128i g, __m128i b) {
+        if(O == ORDER_BGR) {
+            __m128i t = r;
+            r = b;
+            b = t;
+        }
+        __m128i a = _mm_set1_epi8((char)0xff);
+        __m128i rg0 = _mm_unpacklo_epi8(r, g);
+        __m128i rg1 = _mm_unpackhi_epi8(r, g);
+        __m128i ba0 = _mm_unpacklo_epi8(b, a);
+        __m128i ba1 = _mm_unpackhi_epi8(b, a);
+        __m128i px[4] = {
+            _mm_unpacklo_epi16(rg0, ba0),
+            _mm_unpackhi_epi16(rg0, ba0),
+            _mm_unpacklo_epi16(rg1, ba1),
+            _mm_unpackhi_epi16(rg1, ba1)
+        };
+        if(O == ORDER_RGBA) {
+            for(int i=0; i<4; i++)
+                _mm_storeu_si128((__m128i *)(dst + 16*i), px[i]);
+        } else {
+            /* Drop the alpha bytes: 16 bytes in, 12 bytes out */
+            const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+            for(int i=0; i<4; i++)
+                _mm_storeu_si128((__m128i *)(dst + 12*i), _mm_shuffle_epi8(px[i], pack));
+        }
+    }
+
+    template <int L, int O>
+    GESTURECAM_TARGET_AVX2
+    static void convertRowAVX2(const uint8_t *src, uint8_t *dst, int width) {
+        const int bpp = (O == ORDER_RGBA) ? 4 : 3;
+        /* 24-bit stores spill four bytes (under two pixels), so they stop one block early */
+        const int end = (O == ORDER_RGBA) ? width : width - 2;
+        int x = 0;
+        for(; x + 32 <= end; x += 32) {
+            __m256i r0, g0, b0, r1, g1, b1;
+            yuvToRGB16AVX2<L>(_mm256_loadu_si256((const __m256i *)(src + 2*x)), r0, g0, b0);
+            yuvToRGB16AVX2<L>(_mm256_loadu_si256((const __m256i *)(src + 2*x + 32)), r1, g1, b1);
+            /* packus works per lane; put the pixels back in order */
+            __m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), 0xd8);
+            __m256i g = _mm256_permute4x64_epi64(_mm256_packus_epi16(g0, g1), 0xd8);
+            __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(b0, b1), 0xd8);
+            storePixelsAVX2<O>(dst + bpp*x, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+            storePixelsAVX2<O>(dst + bpp*(x+16), _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(b, 1));
+        }
+        convertPixelsScalar<L, O>(src, dst, x, width);
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_NEON
+    /* Chroma term (c0 * a + c1 * b) >> 14 for eight pixel pairs */
+    static inline int16x8_t chromaNEON(int16x8_t a, int16_t c0, int16x8_t b, int16_t c1) {
+        int32x4_t lo = vmull_n_s16(vget_low_s16(a), c0);
+        int32x4_t hi = vmull_n_s16(vget_high_s16(a), c0);
+        lo = vmlal_n_s16(lo, vget_low_s16(b), c1);
+        hi = vmlal_n_s16(hi, vget_high_s16(b), c1);
+        return vcombine_s16(vshrn_n_s32(lo, 14), vshrn_n_s32(hi, 14));
+    }
+
+    template <int L, int O>
+    static void convertRowNEON(const uint8_t *src, uint8_t *dst, int width) {
+        const int bpp = (O == ORDER_RGBA) ? 4 : 3;
+        const int16x8_t bias = vdupq_n_s16(128);
+        int x = 0;
+        for(; x + 16 <= width; x += 16) {
+            /* Deinterleave 16 pixels: even Y, U, odd Y, V (or U, even Y, V, odd Y) */
+            uint8x8x4_t in = vld4_u8(src + 2*x);
+            uint8x8_t y0 = in.val[(L == LAYOUT_YUYV) ? 0 : 1];
+            uint8x8_t y1 = in.val[(L == LAYOUT_YUYV) ? 2 : 3];
+            int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[(L == LAYOUT_YUYV) ? 1 : 0])), bias);
+            int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[(L == LAYOUT_YUYV) ? 3 : 2])), bias);
+
+            int16x8_t rc = chromaNEON(v, COEF_RV, v, 0);
+            int16x8_t gc = chromaNEON(u, COEF_GU, v, COEF_GV);
+            int16x8_t bc = chromaNEON(u, COEF_BU, u, 0);
+
+            int16x8_t ye = vreinterpretq_s16_u16(vmovl_u8(y0));
+            int16x8_t yo = vreinterpretq_s16_u16(vmovl_u8(y1));
+            uint8x8x2_t r = vzip_u8(vqmovun_s16(vaddq_s16(ye, rc)), vqmovun_s16(vaddq_s16(yo, rc)));
+            uint8x8x2_t g = vzip_u8(vqmovun_s16(vaddq_s16(ye, gc)), vqmovun_s16(vaddq_s16(yo, gc)));
+            uint8x8x2_t b = vzip_u8(vqmovun_s16(vaddq_s16(ye, bc)), vqmovun_s16(vaddq_s16(yo, bc)));
+            uint8x16_t rq = vcombine_u8(r.val[0], r.val[1]);
+            uint8x16_t gq = vcombine_u8(g.val[0], g.val[1]);
+            uint8x16_t bq = vcombine_u8(b.val[0], b.val[1]);
+
+            if(O == ORDER_RGBA) {
+                uint8x16x4_t out = {{ rq, gq, bq, vdupq_n_u8(255) }};
+                vst4q_u8(dst + bpp*x, out);
+            } else {
+                uint8x16x3_t out = {{ (O == ORDER_BGR) ? bq : rq, gq, (O == ORDER_BGR) ? rq : bq }};
+                vst3q_u8(dst + bpp*x, out);
+            }
+        }
+        convertPixelsScalar<L, O>(src, dst, x, width);
+    }
+
+    template <int L>
+    static void lumaRowNEON(const uint8_t *src, uint8_t *dst, int width) {
+        int x = 0;
+        for(; x + 16 <= width; x += 16) {
+            uint8x16x2_t in = vld2q_u8(src + 2*x);
+            vst1q_u8(dst + x, in.val[(L == LAYOUT_YUYV) ? 0 : 1]);
+        }
+        lumaPixelsScalar<L>(src, dst, x, width);
+    }
+#endif
+
+    /* Forbid copying */
+    /* Copy constructor */
+    YUVConverter(const YUVConverter &that);
+    /* Copy assignment */
+    YUVConverter& operator=(YUVConverter that);
+};
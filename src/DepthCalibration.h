@@ -0,0 +1,113 @@
+/* DepthCalibration.h, copyright (c) 2014 Robert Xiao
+
+Converts depth phase to calibrated millimetre distances.
+
+The camera measures the phase of modulated IR light, which grows linearly with
+the radial distance of the surface and wraps every 32768 phase units (2 pi).
+A distance is found by subtracting the phase offset of the pixel (a global
+offset plus a per-pixel fixed-pattern correction), wrapping, and scaling by
+millimetres per phase unit. Projecting the radial distance onto the optical
+axis then multiplies it by the cosine of the pixel's viewing angle.
+
+Everything except the subtraction and the multiplication is folded into two
+per-pixel tables when the calibration changes: a phase offset, and a 0.16
+fixed-point gain of millimetres per phase unit that includes the cosine. The
+decode kernels then compute ((phase - offset) & 0x7fff) * gain >> 16, which is
+a single high-half multiply per vector of pixels.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "ofxGestureCam.h"
+#include "Log.h"
+
+#define DEPTH_PHASE_CYCLE 32768 /* phase units per 2 pi */
+
+class DepthDistanceLUT {
+public:
+    static const int width = ofxGestureCam::depth_width;
+    static const int height = ofxGestureCam::depth_height;
+
+    /* Per pixel of the full frame, in row order */
+    int16_t offset[width * height]; /* phase units */
+    uint16_t gain[width * height]; /* mm per phase unit, 0.16 fixed point */
+
+    DepthDistanceLUT() {
+        build(ofxGestureCam::DistanceCalibration());
+    }
+
+    void build(const ofxGestureCam::DistanceCalibration &cal) {
+        bool havePixelOffsets = (cal.pixelOffsets.size() == (size_t)(width * height));
+        for(int y=0; y<height; y++) {
+            for(int x=0; x<width; x++) {
+                int i = width*y + x;
+                double off = cal.phaseOffset + (havePixelOffsets ? cal.pixelOffsets[i] : 0);
+                offset[i] = (int16_t)(int)floor(off + 0.5);
+
+                double mm = cal.mmPerPhase;
+                if(cal.radialToZ && cal.fx > 0 && cal.fy > 0) {
+                    double u = (x - cal.cx) / cal.fx;
+                    double v = (y - cal.cy) / cal.fy;
+                    mm /= sqrt(1 + u*u + v*v);
+                }
+                gain[i] = (uint16_t)std::min(std::max(floor(mm * 65536 + 0.5), 0.0), 65535.0);
+            }
+        }
+    }
+
+    /* Distance in mm for a valid phase at pixel i of the full frame */
+    inline uint16_t distance(int16_t phase, int i) const {
+        uint32_t wrapped = (uint16_t)(phase - offset[i]) & (DEPTH_PHASE_CYCLE - 1);
+        return (wrapped * gain[i]) >> 16;
+    }
+
+    /* Read a calibration file into cal; see ofxGestureCam::loadDistanceCalibration() for the format.
+       Keys missing from the file keep their values in cal. */
+    static bool load(const char *path, ofxGestureCam::DistanceCalibration &cal) {
+        FILE *f = fopen(path, "r");
+        if(f == NULL) {
+            LOGE("Can't open distance calibration %s", path);
+            return false;
+        }
+
+        ofxGestureCam::DistanceCalibration result = cal;
+        bool ok = true;
+        char key[64];
+        while(ok && fscanf(f, " %63s", key) == 1) {
+            if(key[0] == '#') {
+                int c;
+                while((c = fgetc(f)) != EOF && c != '\n')
+                    ;
+            } else if(!strcmp(key, "phase_offset")) {
+                ok = fscanf(f, "%f", &result.phaseOffset) == 1;
+            } else if(!strcmp(key, "mm_per_phase")) {
+                ok = fscanf(f, "%f", &result.mmPerPhase) == 1;
+            } else if(!strcmp(key, "radial_to_z")) {
+                int flag;
+                ok = fscanf(f, "%d", &flag) == 1;
+                result.radialToZ = (flag != 0);
+            } else if(!strcmp(key, "intrinsics")) {
+                ok = fscanf(f, "%f %f %f %f", &result.fx, &result.fy, &result.cx, &result.cy) == 4;
+            } else if(!strcmp(key, "pixel_offsets")) {
+                result.pixelOffsets.resize(width * height);
+                for(int i=0; ok && i<width*height; i++)
+                    ok = fscanf(f, "%hd", &result.pixelOffsets[i]) == 1;
+            } else {
+                LOGE("Unknown key %s in distance calibration %s", key, path);
+                ok = false;
+            }
+        }
+        fclose(f);
+
+        if(!ok) {
+            LOGE("Bad distance calibration %s", path);
+            return false;
+        }
+        cal = result;
+        return true;
+    }
+};
@@ -0,0 +1,210 @@
+/* DepthColormap.h, copyright (c) 2014 Robert Xiao
+
+Maps depth phase to RGB colours for the depth texture.
+
+The colour map is a small RGB table of 2 to 4096 entries, normally 256 (768
+bytes) or 4096 (12 KB), so it stays resident in L1 cache while a frame is
+colourized. Phases between the near and far limits spread linearly over the
+table. Beyond the limits the end colours repeat, or in wrap mode the whole
+table repeats. Phase 0x7fff, which the camera reports for pixels without a
+measurement, has a colour of its own.
+
+Pixels can also be masked to that invalid colour: those with confidence below
+a threshold and, optionally, those outside the near/far range. The decoder
+kernels evaluate the mask in their vector lanes, using getMinConfidence() and
+getMaskLow()/getMaskHigh(), and lookup(phase, confidence) is the scalar
+equivalent.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "ofMain.h"
+
+#define DEPTH_COLORMAP_MAX_SIZE 4096
+#define DEPTH_PHASE_INVALID 0x7fff
+
+class DepthColormap {
+public:
+    enum Builtin {
+        HSB, /* full-saturation hue circle; made for wrap mode */
+        TURBO,
+        GRAYSCALE,
+        JET
+    };
+
+private:
+    int size; /* power of two */
+    int32_t nearPhase, farPhase;
+    int64_t scale; /* table entries per phase unit, << 16 */
+    bool wrap;
+    uint16_t minConfidence;
+    bool maskRange;
+    int16_t maskLow, maskHigh; /* phases outside [maskLow, maskHigh] are masked */
+    uint8_t table[DEPTH_COLORMAP_MAX_SIZE * 3];
+    uint8_t invalid[3];
+
+public:
+    /* Default: the hue circle, repeating every 4096 phase units */
+    DepthColormap() : size(256), nearPhase(-32767), farPhase(-32767 + 4096), wrap(true),
+        minConfidence(0), maskRange(false), maskLow(-32768), maskHigh(32767) {
+        setInvalidColor(ofColor(255, 255, 255));
+        setBuiltin(HSB, 256);
+    }
+
+    /* Fill the table with a built-in map of n entries (rounded to a power of two) */
+    void setBuiltin(Builtin map, int n=256) {
+        n = roundSize(n);
+        std::vector<ofColor> colors(n);
+        for(int i=0; i<n; i++) {
+            float t = (float)i / (n - 1);
+            switch(map) {
+                case HSB: colors[i] = ofColor::fromHsb((float)i * 256 / n, 255, 255); break;
+                case TURBO: colors[i] = turbo(t); break;
+                case GRAYSCALE: colors[i] = ofColor(t * 255 + 0.5f, t * 255 + 0.5f, t * 255 + 0.5f); break;
+                case JET: colors[i] = jet(t); break;
+            }
+        }
+        setTable(colors);
+    }
+
+    /* Fill the table by resampling colors linearly to n entries (rounded to a power of two) */
+    void setColors(const std::vector<ofColor> &colors, int n=256) {
+        if(colors.empty())
+            return;
+        n = roundSize(n);
+        std::vector<ofColor> resampled(n);
+        for(int i=0; i<n; i++) {
+            float pos = (colors.size() == 1) ? 0 : (float)i * (colors.size() - 1) / (n - 1);
+            int j = std::min((int)pos, (int)colors.size() - 1);
+            int k = std::min(j + 1, (int)colors.size() - 1);
+            resampled[i] = colors[j].getLerped(colors[k], pos - j);
+        }
+        setTable(resampled);
+    }
+
+    /* Phases nearPhase..farPhase span the table; farPhase may be below nearPhase to reverse it.
+       With wrap, the table repeats beyond the range instead of clamping to its end colours. */
+    void setRange(int nearPhase, int farPhase, bool wrap=false) {
+        if(farPhase == nearPhase)
+            farPhase = nearPhase + 1;
+        this->nearPhase = nearPhase;
+        this->farPhase = farPhase;
+        this->wrap = wrap;
+        updateScale();
+        updateMask();
+    }
+
+    int getNearPhase() const {
+        return nearPhase;
+    }
+
+    int getFarPhase() const {
+        return farPhase;
+    }
+
+    bool isWrapping() const {
+        return wrap;
+    }
+
+    int getSize() const {
+        return size;
+    }
+
+    /* Mask pixels with confidence below minConfidence and, with maskRange, phases outside the range */
+    void setMask(uint16_t minConfidence, bool maskRange) {
+        this->minConfidence = minConfidence;
+        this->maskRange = maskRange;
+        updateMask();
+    }
+
+    uint16_t getMinConfidence() const {
+        return minConfidence;
+    }
+
+    int16_t getMaskLow() const {
+        return maskLow;
+    }
+
+    int16_t getMaskHigh() const {
+        return maskHigh;
+    }
+
+    /* Colour of masked pixels and pixels without a measurement */
+    void setInvalidColor(const ofColor &color) {
+        invalid[0] = color.r;
+        invalid[1] = color.g;
+        invalid[2] = color.b;
+    }
+
+    /* RGB bytes for a phase */
+    inline const uint8_t *lookup(int16_t phase) const {
+        if(phase == DEPTH_PHASE_INVALID)
+            return invalid;
+        int64_t i = ((int64_t)(phase - nearPhase) * scale) >> 16;
+        if(wrap)
+            i &= size - 1;
+        else
+            i = std::min(std::max(i, (int64_t)0), (int64_t)size - 1);
+        return table + 3*i;
+    }
+
+    /* RGB bytes for a pixel, or the invalid colour if it is masked */
+    inline const uint8_t *lookup(int16_t phase, uint16_t confidence) const {
+        if(confidence < minConfidence || phase < maskLow || phase > maskHigh)
+            return invalid;
+        return lookup(phase);
+    }
+
+private:
+    static int roundSize(int n) {
+        int size = 2;
+        while(size < n && size < DEPTH_COLORMAP_MAX_SIZE)
+            size <<= 1;
+        return size;
+    }
+
+    void setTable(const std::vector<ofColor> &colors) {
+        size = colors.size();
+        for(int i=0; i<size; i++) {
+            table[3*i] = colors[i].r;
+            table[3*i+1] = colors[i].g;
+            table[3*i+2] = colors[i].b;
+        }
+        updateScale();
+    }
+
+    void updateScale() {
+        scale = ((int64_t)size << 16) / (farPhase - nearPhase);
+    }
+
+    void updateMask() {
+        maskLow = -32768;
+        maskHigh = 32767;
+        if(maskRange) {
+            maskLow = std::max(std::min(nearPhase, farPhase), -32768);
+            maskHigh = std::min(std::max(nearPhase, farPhase), 32767);
+        }
+    }
+
+    static float clamp01(float v) {
+        return std::min(std::max(v, 0.0f), 1.0f);
+    }
+
+    /* Polynomial fit of Google's Turbo map */
+    static ofColor turbo(float t) {
+        float r = 0.13572138f + t*(4.61539260f + t*(-42.66032258f + t*(132.13108234f + t*(-152.94239396f + t*59.28637943f))));
+        float g = 0.09140261f + t*(2.19418839f + t*(4.84296658f + t*(-14.18503333f + t*(4.27729857f + t*2.82956604f))));
+        float b = 0.10667330f + t*(12.64194608f + t*(-60.58204836f + t*(110.36276771f + t*(-89.90310912f + t*27.34824973f))));
+        return ofColor(clamp01(r) * 255 + 0.5f, clamp01(g) * 255 + 0.5f, clamp01(b) * 255 + 0.5f);
+    }
+
+    static ofColor jet(float t) {
+        float r = 1.5f - fabsf(4*t - 3);
+        float g = 1.5f - fabsf(4*t - 2);
+        float b = 1.5f - fabsf(4*t - 1);
+        return ofColor(clamp01(r) * 255 + 0.5f, clamp01(g) * 255 + 0.5f, clamp01(b) * 255 + 0.5f);
+    }
+};
@@ -0,0 +1,676 @@
+/* DepthDecoder.h, copyright (c) 2014 Robert Xiao
+
+Converts raw GestureCam depth frames into phase, confidence, distance, colour and
+raw IR maps.
+
+A raw frame is 640x240 int16. Each row holds 320 pixels in blocks of 8: eight
+in-phase (I) samples followed by the eight quadrature (Q) samples of the same
+pixels. The SIMD kernels load one block (SSE2/NEON) or two blocks (AVX2) at a
+time, so the I/Q deinterleave is free. Phase lookups go through the FastAtan2
+tables; AVX2 gathers them, the other kernels fold the quadrants in vector
+registers and look up the tables lane by lane. Every kernel produces results
+bit-identical to the scalar path.
+
+Each kernel is a template over the mask of enabled outputs; setOutputs() picks
+the matching instantiation once, so the inner loops carry no per-pixel
+branches for outputs that nobody asked for.
+
+setRegion() restricts decoding to a rectangle of whole blocks; the outputs are
+then packed maps of just that rectangle, and pixels outside it are never read.
+
+Confidence is |I| + |Q| by default, which the kernels get almost for free but
+which reads up to 41% high along the diagonals. With CONFIDENCE_AMPLITUDE the
+kernels skip it and a second pass over each row computes the true amplitude
+sqrt(I^2 + Q^2) with FastAtan2::cordicBatch().
+
+The colour output applies the colour map's mask (DepthColormap::setMask()) in
+the same lanes as the decode: masked pixels are given the invalid phase before
+their colours are looked up. A confidence mask in CONFIDENCE_AMPLITUDE mode has
+to wait for the amplitude, so then the CORDIC pass colours the pixels instead,
+using its own phase (within a unit of the table phase).
+
+Distances come from the per-pixel tables of a DepthDistanceLUT, which are
+indexed by the pixel's position in the full frame.
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include "ofMain.h"
+
+#include "DepthCalibration.h"
+#include "DepthColormap.h"
+#include "FastAtan2.h"
+#include "SIMD.h"
+#include "WorkerPool.h"
+
+#define DEPTH_RAW_STRIDE 640
+#define DEPTH_BLOCK 8
+
+/* Outputs a decoder can produce. Kernels are instantiated for every combination,
+   so that disabled outputs cost neither branches nor memory traffic. */
+enum DepthOutput {
+    DEPTH_OUTPUT_PHASE = 1 << 0,
+    DEPTH_OUTPUT_CONFIDENCE = 1 << 1,
+    DEPTH_OUTPUT_DISTANCE = 1 << 2,
+    DEPTH_OUTPUT_RAW_IR = 1 << 3,
+    DEPTH_OUTPUT_RGB = 1 << 4,
+    DEPTH_OUTPUT_RAW_IR8 = 1 << 5,
+
+    DEPTH_OUTPUT_COMBINATIONS = 1 << 6,
+    DEPTH_OUTPUT_NEEDS_PHASE = DEPTH_OUTPUT_PHASE | DEPTH_OUTPUT_DISTANCE | DEPTH_OUTPUT_RGB
+};
+
+/* Destination pointers for one decoded frame (the size of the decoder's region).
+   Only the pointers for the decoder's selected outputs are used. */
+struct DepthOutputs {
+    int16_t *phase;
+    uint16_t *confidence;
+    uint16_t *distance;
+    int16_t *rawI, *rawQ;
+    uint8_t *rawI8, *rawQ8;
+    uint8_t *rgb;
+    const DepthColormap *colormap; /* required for DEPTH_OUTPUT_RGB */
+    const DepthDistanceLUT *distanceLUT; /* required for DEPTH_OUTPUT_DISTANCE */
+
+    DepthOutputs() : phase(NULL), confidence(NULL), distance(NULL), rawI(NULL), rawQ(NULL),
+        rawI8(NULL), rawQ8(NULL), rgb(NULL), colormap(NULL), distanceLUT(NULL) {
+    }
+};
+
+class DepthDecoder {
+public:
+    static const int width = 320;
+    static const int height = 240;
+
+    /* Rectangle of the frame to decode; x and width are multiples of DEPTH_BLOCK */
+    struct Region {
+        int x, y, width, height;
+    };
+
+    /* Decode rows [y0, y1) of the region */
+    typedef void (*DecodeRowsFn)(const FastAtan2 &fastAtan, const int16_t *raw, const DepthOutputs &out,
+                                 const Region &region, int y0, int y1);
+
+    /* How DEPTH_OUTPUT_CONFIDENCE is measured */
+    enum ConfidenceMode {
+        CONFIDENCE_L1, /* |I| + |Q| */
+        CONFIDENCE_AMPLITUDE /* sqrt(I^2 + Q^2), by CORDIC */
+    };
+
+    enum ISA {
+        ISA_SCALAR,
+        ISA_SSE2,
+        ISA_AVX2,
+        ISA_NEON
+    };
+
+private:
+    const FastAtan2 &fastAtan;
+    ISA isa;
+    unsigned outputs;
+    Region region;
+    ConfidenceMode confidenceMode;
+    int cordicIterations;
+    DecodeRowsFn kernels[DEPTH_OUTPUT_COMBINATIONS];
+    DecodeRowsFn decodeRowsFn;
+
+public:
+    DepthDecoder(const FastAtan2 &fastAtan) : fastAtan(fastAtan), outputs(0),
+        confidenceMode(CONFIDENCE_L1), cordicIterations(CORDIC_DEFAULT_ITERATIONS) {
+        setRegion(0, 0, width, height);
+        ISA best = ISA_SCALAR;
+#if defined(GESTURECAM_HAVE_NEON)
+        best = ISA_NEON;
+#elif defined(GESTURECAM_HAVE_SSE2)
+        best = ISA_SSE2;
+#endif
+        if(cpuHasAVX2())
+            best = ISA_AVX2;
+        setISA(best);
+    }
+
+    /* Select the set of outputs (a mask of DepthOutput values) produced by decode().
+       Call this whenever the set changes, not per frame. */
+    void setOutputs(unsigned mask) {
+        outputs = mask & (DEPTH_OUTPUT_COMBINATIONS - 1);
+        selectDecodeRows();
+    }
+
+    unsigned getOutputs() const {
+        return outputs;
+    }
+
+    /* Select the confidence measure; iterations sets the CORDIC accuracy for CONFIDENCE_AMPLITUDE.
+       Call this whenever the mode changes, not per frame. */
+    void setConfidenceMode(ConfidenceMode mode, int iterations=CORDIC_DEFAULT_ITERATIONS) {
+        confidenceMode = mode;
+        cordicIterations = iterations;
+        selectDecodeRows();
+    }
+
+    ConfidenceMode getConfidenceMode() const {
+        return confidenceMode;
+    }
+
+    /* Restrict decoding to a rectangle, widened to whole blocks and clipped to the frame.
+       Call this whenever the rectangle changes, not per frame. */
+    void setRegion(int x, int y, int w, int h) {
+        int x1 = std::min(x + w, width);
+        int y1 = std::min(y + h, height);
+        region.x = std::min(std::max(x, 0), width) & ~(DEPTH_BLOCK - 1);
+        region.y = std::min(std::max(y, 0), height);
+        region.width = std::max(((x1 + DEPTH_BLOCK - 1) & ~(DEPTH_BLOCK - 1)) - region.x, 0);
+        region.height = std::max(y1 - region.y, 0);
+    }
+
+    const Region &getRegion() const {
+        return region;
+    }
+
+    /* Decode the whole region */
+    void decode(const int16_t *raw, const DepthOutputs &out) const {
+        decode(raw, out, 0, region.height);
+    }
+
+    /* Decode rows [y0, y1) of the region */
+    void decode(const int16_t *raw, const DepthOutputs &out, int y0, int y1) const {
+        bool amplitudeColor = isAmplitudeColor(out);
+        DecodeRowsFn fn = amplitudeColor ? kernels[kernelOutputs() & ~DEPTH_OUTPUT_RGB] : decodeRowsFn;
+        fn(fastAtan, raw, out, region, y0, y1);
+        if(isAmplitudeConfidence() || amplitudeColor)
+            decodeAmplitudeRows(raw, out, y0, y1, amplitudeColor);
+    }
+
+    /* Decode the whole region, split into row bands across the pool's threads.
+       Without wait, a busy pool is not waited for, and the caller decodes alone. */
+    void decode(const int16_t *raw, const DepthOutputs &out, WorkerPool &pool, bool wait=true) const {
+        BandJob job = { this, raw, &out };
+        if(wait)
+            pool.run(decodeBand, &job);
+        else
+            pool.runNoWait(decodeBand, &job);
+    }
+
+    /* Override the instruction set, e.g. ISA_SCALAR to compare against the SIMD kernels.
+       Requests for an instruction set that was not compiled in fall back to scalar. */
+    void setISA(ISA newIsa) {
+        isa = newIsa;
+        KernelTable<DEPTH_OUTPUT_COMBINATIONS - 1>::fill(kernels, isa);
+        selectDecodeRows();
+    }
+
+    ISA getISA() const {
+        return isa;
+    }
+
+    const char *getISAName() const {
+        switch(isa) {
+            case ISA_SSE2: return "SSE2";
+            case ISA_AVX2: return "AVX2";
+            case ISA_NEON: return "NEON";
+            default: return "scalar";
+        }
+    }
+
+private:
+    bool isAmplitudeConfidence() const {
+        return (outputs & DEPTH_OUTPUT_CONFIDENCE) && confidenceMode == CONFIDENCE_AMPLITUDE;
+    }
+
+    /* Colours masked by amplitude are left to the amplitude pass */
+    bool isAmplitudeColor(const DepthOutputs &out) const {
+        return (outputs & DEPTH_OUTPUT_RGB) && confidenceMode == CONFIDENCE_AMPLITUDE &&
+            out.colormap->getMinConfidence() > 0;
+    }
+
+    /* The amplitude pass writes the confidence, so the kernel can leave it out */
+    unsigned kernelOutputs() const {
+        return isAmplitudeConfidence() ? outputs & ~DEPTH_OUTPUT_CONFIDENCE : outputs;
+    }
+
+    void selectDecodeRows() {
+        decodeRowsFn = kernels[kernelOutputs()];
+    }
+
+    /* CORDIC amplitude (and with color, the masked colours) for rows [y0, y1) of the region */
+    void decodeAmplitudeRows(const int16_t *raw, const DepthOutputs &out, int y0, int y1, bool color) const {
+        int16_t I[width], Q[width], phase[width];
+        uint16_t amplitude[width];
+        for(int y=y0; y<y1; y++) {
+            const int16_t *row = raw + DEPTH_RAW_STRIDE*(region.y + y) + 2*region.x;
+            for(int x=0; x<region.width; x+=DEPTH_BLOCK) {
+                memcpy(I + x, row + 2*x, DEPTH_BLOCK * sizeof(int16_t));
+                memcpy(Q + x, row + 2*x + DEPTH_BLOCK, DEPTH_BLOCK * sizeof(int16_t));
+            }
+            uint16_t *conf = (outputs & DEPTH_OUTPUT_CONFIDENCE) ? out.confidence + region.width*y : amplitude;
+            fastAtan.cordicBatch(Q, I, color ? phase : NULL, conf, region.width, cordicIterations);
+            if(!color)
+                continue;
+            for(int x=0; x<region.width; x++) {
+                int16_t p = (Q[x] == DEPTH_PHASE_INVALID) ? DEPTH_PHASE_INVALID : phase[x];
+                storeColor(out.rgb + 3*(region.width*y + x), out.colormap, p, conf[x]);
+            }
+        }
+    }
+
+    struct BandJob {
+        const DepthDecoder *decoder;
+        const int16_t *raw;
+        const DepthOutputs *out;
+    };
+
+    static void decodeBand(void *userdata, int band, int numBands) {
+        BandJob *job = reinterpret_cast<BandJob *>(userdata);
+        int rows = job->decoder->region.height;
+        job->decoder->decode(job->raw, *job->out, rows * band / numBands, rows * (band + 1) / numBands);
+    }
+
+    template <unsigned Outputs>
+    static DecodeRowsFn selectKernel(ISA isa) {
+        switch(isa) {
+#ifdef GESTURECAM_HAVE_SSE2
+            case ISA_SSE2: return decodeRowsSSE2<Outputs>;
+#endif
+#ifdef GESTURECAM_HAVE_AVX2
+            case ISA_AVX2: return decodeRowsAVX2<Outputs>;
+#endif
+#ifdef GESTURECAM_HAVE_NEON
+            case ISA_NEON: return decodeRowsNEON<Outputs>;
+#endif
+            default: return decodeRowsScalar<Outputs>;
+        }
+    }
+
+    /* Instantiates the kernels for output masks 0..Outputs */
+    template <unsigned Outputs, bool Last = (Outputs == 0)>
+    struct KernelTable {
+        static void fill(DecodeRowsFn *table, ISA isa) {
+            table[Outputs] = selectKernel<Outputs>(isa);
+            KernelTable<Outputs - 1>::fill(table, isa);
+        }
+    };
+
+    template <unsigned Outputs>
+    struct KernelTable<Outputs, true> {
+        static void fill(DecodeRowsFn *table, ISA isa) {
+            table[Outputs] = selectKernel<Outputs>(isa);
+        }
+    };
+
+private:
+    /* Index of region pixel (x, y) in the full frame */
+    static inline int frameIndex(const Region &region, int x, int y) {
+        return width*(region.y + y) + region.x + x;
+    }
+
+    static inline void storeColor(uint8_t *rgbPx, const DepthColormap *colormap, int16_t phase) {
+        const uint8_t *c = colormap->lookup(phase);
+        rgbPx[0] = c[0];
+        rgbPx[1] = c[1];
+        rgbPx[2] = c[2];
+    }
+
+    static inline void storeColor(uint8_t *rgbPx, const DepthColormap *colormap, int16_t phase, uint16_t confidence) {
+        const uint8_t *c = colormap->lookup(phase, confidence);
+        rgbPx[0] = c[0];
+        rgbPx[1] = c[1];
+        rgbPx[2] = c[2];
+    }
+
+    /* Decode the block at src into output pixels [i0, i0+DEPTH_BLOCK), which are frame pixels [t0, t0+DEPTH_BLOCK) */
+    template <unsigned Outputs>
+    static inline void decodeBlockScalar(const FastAtan2 &fastAtan, const int16_t *src, const DepthOutputs &out, int i0, int t0) {
+        for(int j=0; j<DEPTH_BLOCK; j++) {
+            int i = i0 + j;
+            int16_t I = src[j];
+            int16_t Q = src[DEPTH_BLOCK + j];
+            int16_t phase = 0;
+            if(Outputs & DEPTH_OUTPUT_NEEDS_PHASE)
+                phase = (Q == DEPTH_PHASE_INVALID) ? DEPTH_PHASE_INVALID : fastAtan.atan2_16(Q, I);
+            uint16_t confidence = ((I < 0) ? -I : I) + ((Q < 0) ? -Q : Q);
+
+            if(Outputs & DEPTH_OUTPUT_PHASE)
+                out.phase[i] = phase;
+            if(Outputs & DEPTH_OUTPUT_CONFIDENCE)
+                out.confidence[i] = confidence;
+            if(Outputs & DEPTH_OUTPUT_DISTANCE)
+                out.distance[i] = (Q == DEPTH_PHASE_INVALID) ? 0 : out.distanceLUT->distance(phase, t0 + j);
+            if(Outputs & DEPTH_OUTPUT_RAW_IR) {
+                out.rawI[i] = I;
+                out.rawQ[i] = Q;
+            }
+            if(Outputs & DEPTH_OUTPUT_RGB)
+                storeColor(out.rgb + 3*i, out.colormap, phase, confidence);
+            if(Outputs & DEPTH_OUTPUT_RAW_IR8) {
+                out.rawI8[i] = (I >> 1) + 128;
+                out.rawQ8[i] = (Q >> 1) + 128;
+            }
+        }
+    }
+
+    template <unsigned Outputs>
+    static void decodeRowsScalar(const FastAtan2 &fastAtan, const int16_t *raw, const DepthOutputs &out,
+                                 const Region &region, int y0, int y1) {
+        for(int y=y0; y<y1; y++) {
+            const int16_t *row = raw + DEPTH_RAW_STRIDE*(region.y + y) + 2*region.x;
+            for(int x=0; x<region.width; x+=DEPTH_BLOCK)
+                decodeBlockScalar<Outputs>(fastAtan, row + 2*x, out, region.width*y + x, frameIndex(region, x, y));
+        }
+    }
+
+    /* Table lookups for lanes whose quadrant has already been folded away.
+       hi/eq are all-ones/all-zeros lane masks. */
+    static inline void lookupLanes(const FastAtan2 &fastAtan, int16_t *ret, int n,
+                                   const uint16_t *mn, const uint16_t *mx, const uint16_t *hi, const uint16_t *eq) {
+        for(int j=0; j<n; j++) {
+            int32_t r = fastAtan.lookup(mn[j], mx[j], hi[j] & 1);
+            ret[j] = eq[j] ? ATAN_DIAG : r;
+        }
+    }
+
+#ifdef GESTURECAM_HAVE_SSE2
+    static inline __m128i abs16_sse2(__m128i v, __m128i sign) {
+        return _mm_sub_epi16(_mm_xor_si128(v, sign), sign);
+    }
+
+    template <unsigned Outputs>
+    static void decodeRowsSSE2(const FastAtan2 &fastAtan, const int16_t *raw, const DepthOutputs &out,
+                               const Region &region, int y0, int y1) {
+        const __m128i bias = _mm_set1_epi16((short)0x8000);
+        const __m128i lowByte = _mm_set1_epi16(0xff);
+        const __m128i half = _mm_set1_epi16(128);
+        const __m128i invalid = _mm_set1_epi16(0x7fff);
+        const __m128i addQ2 = _mm_set1_epi16(ATAN_ADD_Q2);
+        const __m128i addQ3 = _mm_set1_epi16(ATAN_ADD_Q3);
+        const __m128i addQ4 = _mm_set1_epi16(ATAN_ADD_Q4);
+        const bool color = (Outputs & DEPTH_OUTPUT_RGB) != 0;
+        /* Confidence compares unsigned, so it is biased like mn/mx */
+        const __m128i minConf = _mm_set1_epi16(color ? out.colormap->getMinConfidence() ^ 0x8000 : 0);
+        const __m128i maskLow = _mm_set1_epi16(color ? out.colormap->getMaskLow() : 0);
+        const __m128i maskHigh = _mm_set1_epi16(color ? out.colormap->getMaskHigh() : 0);
+
+        uint16_t mnL[8], mxL[8], hiL[8], eqL[8];
+        int16_t phL[8];
+
+        for(int y=y0; y<y1; y++) {
+            const int16_t *row = raw + DEPTH_RAW_STRIDE*(region.y + y) + 2*region.x;
+            for(int x=0; x<region.width; x+=DEPTH_BLOCK) {
+                const int16_t *src = row + 2*x;
+                int i = region.width*y + x;
+                int t = frameIndex(region, x, y);
+
+                __m128i I = _mm_loadu_si128((const __m128i *)src);
+                __m128i Q = _mm_loadu_si128((const __m128i *)(src + DEPTH_BLOCK));
+                __m128i sI = _mm_srai_epi16(I, 15);
+                __m128i sQ = _mm_srai_epi16(Q, 15);
+                /* |-32768| wraps to 0x8000, which is 32768 when read as unsigned */
+                __m128i aI = abs16_sse2(I, sI);
+                __m128i aQ = abs16_sse2(Q, sQ);
+
+                if(Outputs & DEPTH_OUTPUT_CONFIDENCE)
+                    _mm_storeu_si128((__m128i *)(out.confidence + i), _mm_add_epi16(aI, aQ));
+                if(Outputs & DEPTH_OUTPUT_RAW_IR) {
+                    _mm_storeu_si128((__m128i *)(out.rawI + i), I);
+                    _mm_storeu_si128((__m128i *)(out.rawQ + i), Q);
+                }
+                if(Outputs & DEPTH_OUTPUT_RAW_IR8) {
+                    __m128i i8 = _mm_and_si128(_mm_add_epi16(_mm_srai_epi16(I, 1), half), lowByte);
+                    __m128i q8 = _mm_and_si128(_mm_add_epi16(_mm_srai_epi16(Q, 1), half), lowByte);
+                    __m128i packed = _mm_packus_epi16(i8, q8);
+                    _mm_storel_epi64((__m128i *)(out.rawI8 + i), packed);
+                    _mm_storel_epi64((__m128i *)(out.rawQ8 + i), _mm_srli_si128(packed, 8));
+                }
+                if(!(Outputs & DEPTH_OUTPUT_NEEDS_PHASE))
+                    continue;
+
+                /* Quadrants 2 and 4 swap the roles of |x| and |y| */
+                __m128i swap = _mm_xor_si128(sI, sQ);
+                __m128i bI = _mm_xor_si128(aI, bias);
+                __m128i bQ = _mm_xor_si128(aQ, bias);
+                __m128i mn = _mm_xor_si128(_mm_min_epi16(bI, bQ), bias);
+                __m128i mx = _mm_xor_si128(_mm_max_epi16(bI, bQ), bias);
+                __m128i eq = _mm_cmpeq_epi16(aI, aQ);
+                __m128i hi = _mm_xor_si128(_mm_cmpgt_epi16(bQ, bI), swap);
+                __m128i add = _mm_or_si128(
+                    _mm_and_si128(sQ, _mm_or_si128(_mm_and_si128(sI, addQ3), _mm_andnot_si128(sI, addQ4))),
+                    _mm_andnot_si128(sQ, _mm_and_si128(sI, addQ2)));
+
+                _mm_storeu_si128((__m128i *)mnL, mn);
+                _mm_storeu_si128((__m128i *)mxL, mx);
+                _mm_storeu_si128((__m128i *)hiL, hi);
+                _mm_storeu_si128((__m128i *)eqL, eq);
+                lookupLanes(fastAtan, phL, 8, mnL, mxL, hiL, eqL);
+
+                __m128i phase = _mm_add_epi16(_mm_loadu_si128((const __m128i *)phL), add);
+                __m128i bad = _mm_cmpeq_epi16(Q, invalid);
+                phase = _mm_or_si128(_mm_and_si128(bad, invalid), _mm_andnot_si128(bad, phase));
+
+                if(Outputs & DEPTH_OUTPUT_PHASE)
+                    _mm_storeu_si128((__m128i *)(out.phase + i), phase);
+                if(Outputs & DEPTH_OUTPUT_DISTANCE) {
+                    __m128i offset = _mm_loadu_si128((const __m128i *)(out.distanceLUT->offset + t));
+                    __m128i gain = _mm_loadu_si128((const __m128i *)(out.distanceLUT->gain + t));
+                    __m128i wrapped = _mm_and_si128(_mm_sub_epi16(phase, offset), invalid);
+                    _mm_storeu_si128((__m128i *)(out.distance + i), _mm_andnot_si128(bad, _mm_mulhi_epu16(wrapped, gain)));
+                }
+                if(Outputs & DEPTH_OUTPUT_RGB) {
+                    /* Masked pixels take the invalid colour */
+                    __m128i masked = _mm_or_si128(_mm_cmplt_epi16(phase, maskLow), _mm_cmpgt_epi16(phase, maskHigh));
+                    masked = _mm_or_si128(masked, _mm_cmpgt_epi16(minConf, _mm_xor_si128(_mm_add_epi16(aI, aQ), bias)));
+                    phase = _mm_or_si128(_mm_and_si128(masked, invalid), _mm_andnot_si128(masked, phase));
+                    _mm_storeu_si128((__m128i *)phL, phase);
+                    for(int j=0; j<8; j++)
+                        storeColor(out.rgb + 3*(i+j), out.colormap, phL[j]);
+                }
+            }
+        }
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_AVX2
+    GESTURECAM_TARGET_AVX2
+    static inline __m256i loadBlockPair(const int16_t *src) {
+        return _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+            _mm_loadu_si128((const __m128i *)(src + 2*DEPTH_BLOCK)), 1);
+    }
+
+    GESTURECAM_TARGET_AVX2
+    static inline __m256i lookup8_avx2(const int16_t *tab, const uint32_t *inv, __m128i mn, __m128i mx, __m128i hi) {
+        __m256i mn32 = _mm256_cvtepu16_epi32(mn);
+        __m256i mx32 = _mm256_cvtepu16_epi32(mx);
+        __m256i hi32 = _mm256_cvtepi16_epi32(hi);
+        __m256i r = _mm256_i32gather_epi32((const int *)inv, mx32, 4);
+        r = _mm256_srli_epi32(_mm256_mullo_epi32(mn32, r), 31 - ATAN_BITS);
+        /* The table is int16: gather 32 bits and sign-extend the low half */
+        r = _mm256_i32gather_epi32((const int *)tab, r, 2);
+        r = _mm256_srai_epi32(_mm256_slli_epi32(r, 16), 16);
+        /* High lanes: ATAN_HIGH - r */
+        r = _mm256_sub_epi32(_mm256_xor_si256(r, hi32), hi32);
+        return _mm256_add_epi32(r, _mm256_and_si256(hi32, _mm256_set1_epi32(ATAN_HIGH)));
+    }
+
+    template <unsigned Outputs>
+    GESTURECAM_TARGET_AVX2
+    static void decodeRowsAVX2(const FastAtan2 &fastAtan, const int16_t *raw, const DepthOutputs &out,
+                               const Region &region, int y0, int y1) {
+        const __m256i half = _mm256_set1_epi16(128);
+        const __m256i lowByte = _mm256_set1_epi16(0xff);
+        const __m256i invalid = _mm256_set1_epi16(0x7fff);
+        const __m256i diag = _mm256_set1_epi16(ATAN_DIAG);
+        const __m256i addQ2 = _mm256_set1_epi16(ATAN_ADD_Q2);
+        const __m256i addQ3 = _mm256_set1_epi16(ATAN_ADD_Q3);
+        const __m256i addQ4 = _mm256_set1_epi16(ATAN_ADD_Q4);
+        const bool color = (Outputs & DEPTH_OUTPUT_RGB) != 0;
+        const __m256i minConf = _mm256_set1_epi16(color ? out.colormap->getMinConfidence() : 0);
+        const __m256i maskLow = _mm256_set1_epi16(color ? out.colormap->getMaskLow() : 0);
+        const __m256i maskHigh = _mm256_set1_epi16(color ? out.colormap->getMaskHigh() : 0);
+        const int16_t *tab = fastAtan.atanTable();
+        const uint32_t *inv = fastAtan.invTable();
+
+        int16_t phL[16];
+
+        for(int y=y0; y<y1; y++) {
+            const int16_t *row = raw + DEPTH_RAW_STRIDE*(region.y + y) + 2*region.x;
+            int x = 0;
+            for(; x + 2*DEPTH_BLOCK <= region.width; x+=2*DEPTH_BLOCK) {
+                const int16_t *src = row + 2*x;
+                int i = region.width*y + x;
+                int t = frameIndex(region, x, y);
+
+                __m256i I = loadBlockPair(src);
+                __m256i Q = loadBlockPair(src + DEPTH_BLOCK);
+                __m256i aI = _mm256_abs_epi16(I);
+                __m256i aQ = _mm256_abs_epi16(Q);
+
+                if(Outputs & DEPTH_OUTPUT_CONFIDENCE)
+                    _mm256_storeu_si256((__m256i *)(out.confidence + i), _mm256_add_epi16(aI, aQ));
+                if(Outputs & DEPTH_OUTPUT_RAW_IR) {
+                    _mm256_storeu_si256((__m256i *)(out.rawI + i), I);
+                    _mm256_storeu_si256((__m256i *)(out.rawQ + i), Q);
+                }
+                if(Outputs & DEPTH_OUTPUT_RAW_IR8) {
+                    __m256i i8 = _mm256_and_si256(_mm256_add_epi16(_mm256_srai_epi16(I, 1), half), lowByte);
+                    __m256i q8 = _mm256_and_si256(_mm256_add_epi16(_mm256_srai_epi16(Q, 1), half), lowByte);
+                    /* packus interleaves per 128-bit lane; restore I0-15, Q0-15 order */
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(i8, q8), 0xd8);
+                    _mm_storeu_si128((__m128i *)(out.rawI8 + i), _mm256_castsi256_si128(packed));
+                    _mm_storeu_si128((__m128i *)(out.rawQ8 + i), _mm256_extracti128_si256(packed, 1));
+                }
+                if(!(Outputs & DEPTH_OUTPUT_NEEDS_PHASE))
+                    continue;
+
+                __m256i sI = _mm256_srai_epi16(I, 15);
+                __m256i sQ = _mm256_srai_epi16(Q, 15);
+                __m256i swap = _mm256_xor_si256(sI, sQ);
+                __m256i mn = _mm256_min_epu16(aI, aQ);
+                __m256i mx = _mm256_max_epu16(aI, aQ);
+                __m256i eq = _mm256_cmpeq_epi16(aI, aQ);
+                /* |Q| >= |I|; only differs from |Q| > |I| when eq, which is overridden below */
+                __m256i hi = _mm256_xor_si256(_mm256_cmpeq_epi16(mx, aQ), swap);
+                __m256i add = _mm256_or_si256(
+                    _mm256_and_si256(sQ, _mm256_blendv_epi8(addQ4, addQ3, sI)),
+                    _mm256_andnot_si256(sQ, _mm256_and_si256(sI, addQ2)));
+
+                __m256i lo = lookup8_avx2(tab, inv, _mm256_castsi256_si128(mn), _mm256_castsi256_si128(mx), _mm256_castsi256_si128(hi));
+                __m256i hh = lookup8_avx2(tab, inv, _mm256_extracti128_si256(mn, 1), _mm256_extracti128_si256(mx, 1), _mm256_extracti128_si256(hi, 1));
+                __m256i phase = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hh), 0xd8);
+                phase = _mm256_blendv_epi8(phase, diag, eq);
+                phase = _mm256_add_epi16(phase, add);
+                __m256i bad = _mm256_cmpeq_epi16(Q, invalid);
+                phase = _mm256_blendv_epi8(phase, invalid, bad);
+
+                if(Outputs & DEPTH_OUTPUT_PHASE)
+                    _mm256_storeu_si256((__m256i *)(out.phase + i), phase);
+                if(Outputs & DEPTH_OUTPUT_DISTANCE) {
+                    __m256i offset = _mm256_loadu_si256((const __m256i *)(out.distanceLUT->offset + t));
+                    __m256i gain = _mm256_loadu_si256((const __m256i *)(out.distanceLUT->gain + t));
+                    __m256i wrapped = _mm256_and_si256(_mm256_sub_epi16(phase, offset), invalid);
+                    _mm256_storeu_si256((__m256i *)(out.distance + i), _mm256_andnot_si256(bad, _mm256_mulhi_epu16(wrapped, gain)));
+                }
+                if(Outputs & DEPTH_OUTPUT_RGB) {
+                    /* Masked pixels take the invalid colour; conf < minConf iff max(conf, minConf) != conf */
+                    __m256i conf = _mm256_add_epi16(aI, aQ);
+                    __m256i masked = _mm256_or_si256(_mm256_cmpgt_epi16(maskLow, phase), _mm256_cmpgt_epi16(phase, maskHigh));
+                    masked = _mm256_or_si256(masked, _mm256_andnot_si256(
+                        _mm256_cmpeq_epi16(_mm256_max_epu16(conf, minConf), conf), _mm256_set1_epi16(-1)));
+                    phase = _mm256_blendv_epi8(phase, invalid, masked);
+                    _mm256_storeu_si256((__m256i *)phL, phase);
+                    for(int j=0; j<16; j++)
+                        storeColor(out.rgb + 3*(i+j), out.colormap, phL[j]);
+                }
+            }
+            /* A region an odd number of blocks wide leaves one block over */
+            if(x < region.width)
+                decodeBlockScalar<Outputs>(fastAtan, row + 2*x, out, region.width*y + x, frameIndex(region, x, y));
+        }
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_NEON
+    template <unsigned Outputs>
+    static void decodeRowsNEON(const FastAtan2 &fastAtan, const int16_t *raw, const DepthOutputs &out,
+                               const Region &region, int y0, int y1) {
+        const int16x8_t half = vdupq_n_s16(128);
+        const int16x8_t invalid = vdupq_n_s16(0x7fff);
+        const uint16x8_t addQ2 = vdupq_n_u16((uint16_t)ATAN_ADD_Q2);
+        const uint16x8_t addQ3 = vdupq_n_u16((uint16_t)ATAN_ADD_Q3);
+        const uint16x8_t addQ4 = vdupq_n_u16((uint16_t)ATAN_ADD_Q4);
+        const bool color = (Outputs & DEPTH_OUTPUT_RGB) != 0;
+        const uint16x8_t minConf = vdupq_n_u16(color ? out.colormap->getMinConfidence() : 0);
+        const int16x8_t maskLow = vdupq_n_s16(color ? out.colormap->getMaskLow() : 0);
+        const int16x8_t maskHigh = vdupq_n_s16(color ? out.colormap->getMaskHigh() : 0);
+
+        uint16_t mnL[8], mxL[8], hiL[8], eqL[8];
+        int16_t phL[8];
+
+        for(int y=y0; y<y1; y++) {
+            const int16_t *row = raw + DEPTH_RAW_STRIDE*(region.y + y) + 2*region.x;
+            for(int x=0; x<region.width; x+=DEPTH_BLOCK) {
+                const int16_t *src = row + 2*x;
+                int i = region.width*y + x;
+                int t = frameIndex(region, x, y);
+
+                int16x8_t I = vld1q_s16(src);
+                int16x8_t Q = vld1q_s16(src + DEPTH_BLOCK);
+                /* vabs (not vqabs): |-32768| wraps to 0x8000 like the scalar path */
+                uint16x8_t aI = vreinterpretq_u16_s16(vabsq_s16(I));
+                uint16x8_t aQ = vreinterpretq_u16_s16(vabsq_s16(Q));
+
+                if(Outputs & DEPTH_OUTPUT_CONFIDENCE)
+                    vst1q_u16(out.confidence + i, vaddq_u16(aI, aQ));
+                if(Outputs & DEPTH_OUTPUT_RAW_IR) {
+                    vst1q_s16(out.rawI + i, I);
+                    vst1q_s16(out.rawQ + i, Q);
+                }
+                if(Outputs & DEPTH_OUTPUT_RAW_IR8) {
+                    vst1_u8(out.rawI8 + i, vmovn_u16(vreinterpretq_u16_s16(vaddq_s16(vshrq_n_s16(I, 1), half))));
+                    vst1_u8(out.rawQ8 + i, vmovn_u16(vreinterpretq_u16_s16(vaddq_s16(vshrq_n_s16(Q, 1), half))));
+                }
+                if(!(Outputs & DEPTH_OUTPUT_NEEDS_PHASE))
+                    continue;
+
+                uint16x8_t sI = vreinterpretq_u16_s16(vshrq_n_s16(I, 15));
+                uint16x8_t sQ = vreinterpretq_u16_s16(vshrq_n_s16(Q, 15));
+                uint16x8_t swap = veorq_u16(sI, sQ);
+                uint16x8_t hi = veorq_u16(vcgtq_u16(aQ, aI), swap);
+                uint16x8_t add = vorrq_u16(
+                    vandq_u16(sQ, vbslq_u16(sI, addQ3, addQ4)),
+                    vbicq_u16(vandq_u16(sI, addQ2), sQ));
+
+                vst1q_u16(mnL, vminq_u16(aI, aQ));
+                vst1q_u16(mxL, vmaxq_u16(aI, aQ));
+                vst1q_u16(hiL, hi);
+                vst1q_u16(eqL, vceqq_u16(aI, aQ));
+                lookupLanes(fastAtan, phL, 8, mnL, mxL, hiL, eqL);
+
+                int16x8_t phase = vaddq_s16(vld1q_s16(phL), vreinterpretq_s16_u16(add));
+                uint16x8_t bad = vceqq_s16(Q, invalid);
+                phase = vbslq_s16(bad, invalid, phase);
+
+                if(Outputs & DEPTH_OUTPUT_PHASE)
+                    vst1q_s16(out.phase + i, phase);
+                if(Outputs & DEPTH_OUTPUT_DISTANCE) {
+                    int16x8_t offset = vld1q_s16(out.distanceLUT->offset + t);
+                    uint16x8_t gain = vld1q_u16(out.distanceLUT->gain + t);
+                    uint16x8_t wrapped = vreinterpretq_u16_s16(vandq_s16(vsubq_s16(phase, offset), invalid));
+                    uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(wrapped), vget_low_u16(gain)), 16);
+                    uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(wrapped), vget_high_u16(gain)), 16);
+                    vst1q_u16(out.distance + i, vbicq_u16(vcombine_u16(lo, hi), bad));
+                }
+                if(Outputs & DEPTH_OUTPUT_RGB) {
+                    /* Masked pixels take the invalid colour */
+                    uint16x8_t masked = vorrq_u16(vcltq_s16(phase, maskLow), vcgtq_s16(phase, maskHigh));
+                    masked = vorrq_u16(masked, vcltq_u16(vaddq_u16(aI, aQ), minConf));
+                    phase = vbslq_s16(masked, invalid, phase);
+                    vst1q_s16(phL, phase);
+                    for(int j=0; j<8; j++)
+                        storeColor(out.rgb + 3*(i+j), out.colormap, phL[j]);
+                }
+            }
+        }
+    }
+#endif
+};
@@ -5,33 +5,197 @@ operands. The computation itself contains no floating-point operations (assuming
 that your compiler properly folds the floating-point constants into integers).
 On my ARM machine (Exynos 5420), this routine is over 16 times faster than
 libm's atan2f.
+
+The tables only depend on the constants below, so they are built once per
+process, on first use, and shared by every FastAtan2. Only atan(i/N) is
+tabulated: the other half of the octant follows from atan(N/i) = pi/2 - atan(i/N),
+and the values fit in int16, so the arctangent table takes 32 KB instead of
+128 KB.
+
+atan2Batch() takes whole arrays instead, and uses no tables at all: it reduces
+each pair to the first octant with min/max and sign masks, evaluates a minimax
+polynomial in single precision, and reflects the result back, all without
+branches, so SSE2, AVX2 and NEON can run it on 4-8 pairs per instruction.
+
+cordicBatch() is the fixed-point alternative that also gives the Euclidean
+amplitude sqrt(x^2 + y^2) in the same pass: vectoring-mode CORDIC rotates each
+(x, y) onto the x axis with shift-and-add steps, accumulating the angle, and the
+final x is the amplitude times the known CORDIC gain. Each iteration adds about
+one bit of accuracy, so the iteration count trades accuracy against speed.
 */
+#pragma once
 
 #include <math.h>
+#include <stdint.h>
 
-/* 14 bits is all we need to achieve an accuracy of +/- 1. */
+#include "SIMD.h"
+
+/* 14 bits keep atan2_16() within about +/- 2 (see tests/fastatan2_accuracy.cpp). */
 #define ATAN_BITS 14
 #define ATAN_SIZE (1<<ATAN_BITS)
 #define ATAN_SCALE -5215.2 // _rescalingFactor
 
-class FastAtan2 {
+/* Constants added to the first-octant result for each quadrant, and the result for |y| == |x|. */
+#define ATAN_ADD_Q2 ((int16_t)(M_PI/2 * ATAN_SCALE + 0.5f))
+#define ATAN_ADD_Q3 ((int16_t)(-M_PI * ATAN_SCALE + 0.5f))
+#define ATAN_ADD_Q4 ((int16_t)(-M_PI/2 * ATAN_SCALE + 0.5f))
+#define ATAN_DIAG   ((int16_t)(M_PI/4 * ATAN_SCALE + 0.5f))
+/* atan(N/i) == ATAN_HIGH - atan(i/N) */
+#define ATAN_HIGH   ((int16_t)floor(M_PI/2 * ATAN_SCALE + 0.5))
+
+/* CORDIC works on int32 lanes: inputs are shifted up by CORDIC_INPUT_SHIFT bits
+   (the grown amplitude still fits in 31 bits), and angles carry CORDIC_PHASE_BITS
+   fractional bits of phase units. */
+#define CORDIC_MAX_ITERATIONS 24
+#define CORDIC_DEFAULT_ITERATIONS 16
+#define CORDIC_INPUT_SHIFT 14
+#define CORDIC_PHASE_BITS 15
+
+struct FastAtan2Tables {
     uint32_t inv[32769];
-    int32_t atan_low[ATAN_SIZE+1];
-    int32_t atan_high[ATAN_SIZE+1];
+    /* atan(i/N), rounded. The spare last entry lets SIMD code gather 32 bits at index N. */
+    int16_t atan_low[ATAN_SIZE+2];
 
-public:
-    FastAtan2() {
-        for(int i=0; i<=32768; i++) {
+    /* CORDIC: atan(2^-i) and pi in fixed-point phase units, and the factor that
+       turns the final x of an n-iteration CORDIC back into the amplitude */
+    int32_t cordic_atan[CORDIC_MAX_ITERATIONS];
+    int32_t cordic_pi;
+    float cordic_scale[CORDIC_MAX_ITERATIONS+1];
+
+    FastAtan2Tables() {
+        inv[0] = 0; /* only used when both operands are 0 */
+        for(int i=1; i<=32768; i++) {
             inv[i] = round(32768.0 * 65536.0 / i);
         }
 
         for(int i=0; i<=ATAN_SIZE; i++) {
-            atan_low[i] = atan2f(i, ATAN_SIZE) * ATAN_SCALE;
-            atan_high[i] = atan2f(ATAN_SIZE, i) * ATAN_SCALE;
+            atan_low[i] = floor(atan2((double)i, ATAN_SIZE) * ATAN_SCALE + 0.5);
+        }
+        atan_low[ATAN_SIZE+1] = 0;
+
+        double gain = 1;
+        cordic_scale[0] = 1.0 / (1 << CORDIC_INPUT_SHIFT);
+        for(int i=0; i<CORDIC_MAX_ITERATIONS; i++) {
+            cordic_atan[i] = floor(atan(ldexp(1.0, -i)) * ATAN_SCALE * (1 << CORDIC_PHASE_BITS) + 0.5);
+            gain *= sqrt(1 + ldexp(1.0, -2*i));
+            cordic_scale[i+1] = 1.0 / (gain * (1 << CORDIC_INPUT_SHIFT));
+        }
+        cordic_pi = floor(M_PI * ATAN_SCALE * (1 << CORDIC_PHASE_BITS) + 0.5);
+    }
+};
+
+/* Minimax polynomial for atan(t), t in [0, 1]: t * (A1 + A3 t^2 + ... + A9 t^8),
+   within 1e-5 radians (0.06 units) of the exact value. */
+#define ATAN_POLY_A1 0.9998660f
+#define ATAN_POLY_A3 -0.3302995f
+#define ATAN_POLY_A5 0.1801410f
+#define ATAN_POLY_A7 -0.0851330f
+#define ATAN_POLY_A9 0.0208351f
+
+class FastAtan2 {
+public:
+    enum ISA {
+        ISA_SCALAR,
+        ISA_SSE2,
+        ISA_AVX2,
+        ISA_NEON
+    };
+
+    typedef void (*BatchFn)(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n);
+    typedef void (*CordicFn)(const FastAtan2Tables &tables, const int16_t *y, const int16_t *x,
+                             int16_t *phase, uint16_t *amplitude, int n, int iterations);
+
+private:
+    const FastAtan2Tables &tables;
+    ISA isa;
+    BatchFn batchFn;
+    CordicFn cordicFn;
+
+    static const FastAtan2Tables &sharedTables() {
+        static const FastAtan2Tables instance;
+        return instance;
+    }
+
+public:
+    FastAtan2() : tables(sharedTables()) {
+        ISA best = ISA_SCALAR;
+#if defined(GESTURECAM_HAVE_NEON)
+        best = ISA_NEON;
+#elif defined(GESTURECAM_HAVE_SSE2)
+        best = ISA_SSE2;
+#endif
+        if(cpuHasAVX2())
+            best = ISA_AVX2;
+        setISA(best);
+    }
+
+    /* atan2 of n (y, x) pairs: phase[i] = atan2(y[i], x[i]) * ATAN_SCALE, rounded to
+       nearest, so within +/- 1 of the exact value for every int16 pair.
+       amplitude, if not NULL, gets |y[i]| + |x[i]| (wrapping like the depth confidence).
+       Unlike atan2_16() this never touches the tables. Scalar, SSE2 and AVX2 agree exactly;
+       NEON divides (ARMv7: by reciprocal estimate), fuses and rounds differently, so its
+       phases only share the +/- 1 bound. */
+    void atan2Batch(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n) const {
+        batchFn(y, x, phase, amplitude, n);
+    }
+
+    /* Phase (as atan2Batch()) and Euclidean amplitude sqrt(y^2 + x^2) of n pairs by CORDIC.
+       The phase error is about atan(2^(1-iterations)) radians, plus rounding: 16 iterations
+       (the default) keep it within +/- 1 unit. Either output may be NULL. Phases are the
+       same for every instruction set, and so are amplitudes except on ARMv7 NEON, which
+       rounds halves away from zero rather than to even. */
+    void cordicBatch(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n,
+                     int iterations=CORDIC_DEFAULT_ITERATIONS) const {
+        if(iterations < 1)
+            iterations = 1;
+        if(iterations > CORDIC_MAX_ITERATIONS)
+            iterations = CORDIC_MAX_ITERATIONS;
+        cordicFn(tables, y, x, phase, amplitude, n, iterations);
+    }
+
+    /* Override the instruction set used by atan2Batch() and cordicBatch(), e.g. ISA_SCALAR to compare
+       against the SIMD kernels. Requests for an instruction set that was not compiled in fall back to scalar. */
+    void setISA(ISA newIsa) {
+        isa = newIsa;
+        switch(isa) {
+#ifdef GESTURECAM_HAVE_SSE2
+            case ISA_SSE2: batchFn = atan2BatchSSE2; cordicFn = cordicBatchSSE2; break;
+#endif
+#ifdef GESTURECAM_HAVE_AVX2
+            case ISA_AVX2: batchFn = atan2BatchAVX2; cordicFn = cordicBatchAVX2; break;
+#endif
+#ifdef GESTURECAM_HAVE_NEON
+            case ISA_NEON: batchFn = atan2BatchNEON; cordicFn = cordicBatchNEON; break;
+#endif
+            default: batchFn = atan2BatchScalar; cordicFn = cordicBatchScalar; break;
         }
     }
 
-    inline int16_t atan2_16(int16_t y, int16_t x) {
+    ISA getISA() const {
+        return isa;
+    }
+
+    const char *getISAName() const {
+        switch(isa) {
+            case ISA_SSE2: return "SSE2";
+            case ISA_AVX2: return "AVX2";
+            case ISA_NEON: return "NEON";
+            default: return "scalar";
+        }
+    }
+
+    /* Raw tables, for vectorized callers */
+    const uint32_t *invTable() const { return tables.inv; }
+    const int16_t *atanTable() const { return tables.atan_low; }
+
+    /* First-octant lookup: mn <= mx, both in [0, 32768].
+       high selects atan(mx/mn) rather than atan(mn/mx). */
+    inline int32_t lookup(uint32_t mn, uint32_t mx, int high) const {
+        int32_t low = tables.atan_low[(mn * tables.inv[mx]) >> (31 - ATAN_BITS)];
+        return high ? ATAN_HIGH - low : low;
+    }
+
+    inline int16_t atan2_16(int16_t y, int16_t x) const {
         uint32_t yy, xx;
         int16_t add;
         int16_t ret;
@@ -40,19 +204,19 @@ public:
                 /* quadrant 3 */
                 yy = -y;
                 xx = -x;
-                add = (int16_t)(-M_PI * ATAN_SCALE + 0.5f);
+                add = ATAN_ADD_Q3;
             } else {
                 /* quadrant 4 */
                 yy = x;
                 xx = -y;
-                add = (int16_t)(-M_PI/2 * ATAN_SCALE + 0.5f);
+                add = ATAN_ADD_Q4;
             }
         } else {
             if(x < 0) {
                 /* quadrant 2 */
                 yy = -x;
                 xx = y;
-                add = (int16_t)(M_PI/2 * ATAN_SCALE + 0.5f);
+                add = ATAN_ADD_Q2;
             } else {
                 /* quadrant 1 */
                 yy = y;
@@ -63,13 +227,364 @@ public:
 
         /* xx, yy are positive and <= 32768 */
         if(yy == xx) {
-            ret = (int16_t)(M_PI/4 * ATAN_SCALE + 0.5f);
+            ret = ATAN_DIAG;
         } else if(yy > xx) {
-            ret = atan_high[(xx * inv[yy]) >> (31 - ATAN_BITS)];
+            ret = lookup(xx, yy, 1);
         } else {
-            ret = atan_low[(yy * inv[xx]) >> (31 - ATAN_BITS)];
+            ret = lookup(yy, xx, 0);
         }
 
         return ret + add;
     }
+
+private:
+    static inline int16_t atan2Poly(int16_t y, int16_t x) {
+        float ax = fabsf(x);
+        float ay = fabsf(y);
+        float mn = (ax < ay) ? ax : ay;
+        float mx = (ax < ay) ? ay : ax;
+        float t = mn / ((mx < 1.0f) ? 1.0f : mx);
+        float t2 = t * t;
+        float p = t * (ATAN_POLY_A1 + t2 * (ATAN_POLY_A3 + t2 * (ATAN_POLY_A5 + t2 * (ATAN_POLY_A7 + t2 * ATAN_POLY_A9))));
+        if(ay > ax)
+            p = (float)(M_PI/2) - p;
+        if(x < 0)
+            p = (float)M_PI - p;
+        if(y < 0)
+            p = -p;
+        return lrintf(p * (float)ATAN_SCALE);
+    }
+
+    static inline void atan2PolyPixels(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int i, int n) {
+        for(; i<n; i++) {
+            phase[i] = atan2Poly(y[i], x[i]);
+            if(amplitude)
+                amplitude[i] = ((y[i] < 0) ? -y[i] : y[i]) + ((x[i] < 0) ? -x[i] : x[i]);
+        }
+    }
+
+    static void atan2BatchScalar(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n) {
+        atan2PolyPixels(y, x, phase, amplitude, 0, n);
+    }
+
+    /* Negate v where mask is all ones */
+    static inline int32_t negateIf(int32_t v, int32_t mask) {
+        return (v ^ mask) - mask;
+    }
+
+    static inline void cordicPixels(const FastAtan2Tables &t, const int16_t *y, const int16_t *x,
+                                    int16_t *phase, uint16_t *amplitude, int i, int n, int iterations) {
+        for(; i<n; i++) {
+            int32_t xx = (int32_t)x[i] << CORDIC_INPUT_SHIFT;
+            int32_t yy = (int32_t)y[i] << CORDIC_INPUT_SHIFT;
+            /* Rotate the left half-plane by pi, so that CORDIC converges */
+            int32_t left = xx >> 31;
+            int32_t z = left & negateIf(t.cordic_pi, yy >> 31);
+            xx = negateIf(xx, left);
+            yy = negateIf(yy, left);
+            for(int k=0; k<iterations; k++) {
+                /* Rotate towards the x axis by atan(2^-k): up if below it, down otherwise */
+                int32_t up = yy >> 31;
+                int32_t dx = negateIf(yy >> k, up);
+                int32_t dy = negateIf(xx >> k, up);
+                xx += dx;
+                yy -= dy;
+                z += negateIf(t.cordic_atan[k], up);
+            }
+            if(phase)
+                phase[i] = (z + (1 << (CORDIC_PHASE_BITS - 1))) >> CORDIC_PHASE_BITS;
+            if(amplitude)
+                amplitude[i] = lrintf((float)xx * t.cordic_scale[iterations]);
+        }
+    }
+
+    static void cordicBatchScalar(const FastAtan2Tables &t, const int16_t *y, const int16_t *x,
+                                  int16_t *phase, uint16_t *amplitude, int n, int iterations) {
+        cordicPixels(t, y, x, phase, amplitude, 0, n, iterations);
+    }
+
+#ifdef GESTURECAM_HAVE_SSE2
+    /* Four pairs, as floats, to scaled phase */
+    static inline __m128 atan2PolySSE2(__m128 y, __m128 x) {
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        __m128 ax = _mm_andnot_ps(sign, x);
+        __m128 ay = _mm_andnot_ps(sign, y);
+        __m128 t = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1.0f)));
+        __m128 t2 = _mm_mul_ps(t, t);
+        __m128 p = _mm_add_ps(_mm_set1_ps(ATAN_POLY_A7), _mm_mul_ps(t2, _mm_set1_ps(ATAN_POLY_A9)));
+        p = _mm_add_ps(_mm_set1_ps(ATAN_POLY_A5), _mm_mul_ps(t2, p));
+        p = _mm_add_ps(_mm_set1_ps(ATAN_POLY_A3), _mm_mul_ps(t2, p));
+        p = _mm_add_ps(_mm_set1_ps(ATAN_POLY_A1), _mm_mul_ps(t2, p));
+        p = _mm_mul_ps(t, p);
+        __m128 m = _mm_cmpgt_ps(ay, ax);
+        p = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps((float)(M_PI/2)), p)), _mm_andnot_ps(m, p));
+        m = _mm_cmplt_ps(x, _mm_setzero_ps());
+        p = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps((float)M_PI), p)), _mm_andnot_ps(m, p));
+        p = _mm_xor_ps(p, _mm_and_ps(y, sign));
+        return _mm_mul_ps(p, _mm_set1_ps((float)ATAN_SCALE));
+    }
+
+    static void atan2BatchSSE2(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n) {
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m128i Y = _mm_loadu_si128((const __m128i *)(y + i));
+            __m128i X = _mm_loadu_si128((const __m128i *)(x + i));
+            /* Sign-extend to int32 by placing each value in the high half */
+            __m128 ylo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(Y, Y), 16));
+            __m128 yhi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(Y, Y), 16));
+            __m128 xlo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(X, X), 16));
+            __m128 xhi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(X, X), 16));
+            __m128i lo = _mm_cvtps_epi32(atan2PolySSE2(ylo, xlo));
+            __m128i hi = _mm_cvtps_epi32(atan2PolySSE2(yhi, xhi));
+            _mm_storeu_si128((__m128i *)(phase + i), _mm_packs_epi32(lo, hi));
+            if(amplitude) {
+                __m128i sY = _mm_srai_epi16(Y, 15);
+                __m128i sX = _mm_srai_epi16(X, 15);
+                __m128i aY = _mm_sub_epi16(_mm_xor_si128(Y, sY), sY);
+                __m128i aX = _mm_sub_epi16(_mm_xor_si128(X, sX), sX);
+                _mm_storeu_si128((__m128i *)(amplitude + i), _mm_add_epi16(aY, aX));
+            }
+        }
+        atan2PolyPixels(y, x, phase, amplitude, i, n);
+    }
+
+    static inline __m128i negateIfSSE2(__m128i v, __m128i mask) {
+        return _mm_sub_epi32(_mm_xor_si128(v, mask), mask);
+    }
+
+    /* Four pairs, as int32, to phase and amplitude (both int32) */
+    static inline void cordicSSE2(const FastAtan2Tables &t, __m128i y, __m128i x, int iterations, __m128i &z, __m128 &amp) {
+        x = _mm_slli_epi32(x, CORDIC_INPUT_SHIFT);
+        y = _mm_slli_epi32(y, CORDIC_INPUT_SHIFT);
+        __m128i left = _mm_srai_epi32(x, 31);
+        z = _mm_and_si128(left, negateIfSSE2(_mm_set1_epi32(t.cordic_pi), _mm_srai_epi32(y, 31)));
+        x = negateIfSSE2(x, left);
+        y = negateIfSSE2(y, left);
+        for(int k=0; k<iterations; k++) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            __m128i up = _mm_srai_epi32(y, 31);
+            __m128i dx = negateIfSSE2(_mm_sra_epi32(y, shift), up);
+            __m128i dy = negateIfSSE2(_mm_sra_epi32(x, shift), up);
+            x = _mm_add_epi32(x, dx);
+            y = _mm_sub_epi32(y, dy);
+            z = _mm_add_epi32(z, negateIfSSE2(_mm_set1_epi32(t.cordic_atan[k]), up));
+        }
+        z = _mm_srai_epi32(_mm_add_epi32(z, _mm_set1_epi32(1 << (CORDIC_PHASE_BITS - 1))), CORDIC_PHASE_BITS);
+        amp = _mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(t.cordic_scale[iterations]));
+    }
+
+    static void cordicBatchSSE2(const FastAtan2Tables &t, const int16_t *y, const int16_t *x,
+                                int16_t *phase, uint16_t *amplitude, int n, int iterations) {
+        const __m128i bias = _mm_set1_epi32(32768);
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m128i Y = _mm_loadu_si128((const __m128i *)(y + i));
+            __m128i X = _mm_loadu_si128((const __m128i *)(x + i));
+            __m128i zlo, zhi;
+            __m128 alo, ahi;
+            cordicSSE2(t, _mm_srai_epi32(_mm_unpacklo_epi16(Y, Y), 16), _mm_srai_epi32(_mm_unpacklo_epi16(X, X), 16),
+                iterations, zlo, alo);
+            cordicSSE2(t, _mm_srai_epi32(_mm_unpackhi_epi16(Y, Y), 16), _mm_srai_epi32(_mm_unpackhi_epi16(X, X), 16),
+                iterations, zhi, ahi);
+            if(phase)
+                _mm_storeu_si128((__m128i *)(phase + i), _mm_packs_epi32(zlo, zhi));
+            if(amplitude) {
+                /* No unsigned 32->16 pack in SSE2: pack around zero, then flip the top bit back */
+                __m128i lo = _mm_sub_epi32(_mm_cvtps_epi32(alo), bias);
+                __m128i hi = _mm_sub_epi32(_mm_cvtps_epi32(ahi), bias);
+                _mm_storeu_si128((__m128i *)(amplitude + i),
+                    _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16((short)0x8000)));
+            }
+        }
+        cordicPixels(t, y, x, phase, amplitude, i, n, iterations);
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_AVX2
+    GESTURECAM_TARGET_AVX2
+    static inline __m256 atan2PolyAVX2(__m256 y, __m256 x) {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        __m256 ax = _mm256_andnot_ps(sign, x);
+        __m256 ay = _mm256_andnot_ps(sign, y);
+        __m256 t = _mm256_div_ps(_mm256_min_ps(ax, ay), _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1.0f)));
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(ATAN_POLY_A7), _mm256_mul_ps(t2, _mm256_set1_ps(ATAN_POLY_A9)));
+        p = _mm256_add_ps(_mm256_set1_ps(ATAN_POLY_A5), _mm256_mul_ps(t2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(ATAN_POLY_A3), _mm256_mul_ps(t2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(ATAN_POLY_A1), _mm256_mul_ps(t2, p));
+        p = _mm256_mul_ps(t, p);
+        p = _mm256_blendv_ps(p, _mm256_sub_ps(_mm256_set1_ps((float)(M_PI/2)), p), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+        p = _mm256_blendv_ps(p, _mm256_sub_ps(_mm256_set1_ps((float)M_PI), p), x);
+        p = _mm256_xor_ps(p, _mm256_and_ps(y, sign));
+        return _mm256_mul_ps(p, _mm256_set1_ps((float)ATAN_SCALE));
+    }
+
+    GESTURECAM_TARGET_AVX2
+    static void atan2BatchAVX2(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n) {
+        int i = 0;
+        for(; i + 16 <= n; i += 16) {
+            __m256i Y = _mm256_loadu_si256((const __m256i *)(y + i));
+            __m256i X = _mm256_loadu_si256((const __m256i *)(x + i));
+            __m256 ylo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(Y)));
+            __m256 yhi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(Y, 1)));
+            __m256 xlo = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(X)));
+            __m256 xhi = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(X, 1)));
+            __m256i lo = _mm256_cvtps_epi32(atan2PolyAVX2(ylo, xlo));
+            __m256i hi = _mm256_cvtps_epi32(atan2PolyAVX2(yhi, xhi));
+            /* packs works per 128-bit lane; restore element order */
+            _mm256_storeu_si256((__m256i *)(phase + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8));
+            if(amplitude)
+                _mm256_storeu_si256((__m256i *)(amplitude + i), _mm256_add_epi16(_mm256_abs_epi16(Y), _mm256_abs_epi16(X)));
+        }
+        atan2PolyPixels(y, x, phase, amplitude, i, n);
+    }
+
+    GESTURECAM_TARGET_AVX2
+    static inline __m256i negateIfAVX2(__m256i v, __m256i mask) {
+        return _mm256_sub_epi32(_mm256_xor_si256(v, mask), mask);
+    }
+
+    /* Eight pairs, as int32, to phase (int32) and amplitude (int32) */
+    GESTURECAM_TARGET_AVX2
+    static inline void cordicAVX2(const FastAtan2Tables &t, __m256i y, __m256i x, int iterations, __m256i &z, __m256i &amp) {
+        x = _mm256_slli_epi32(x, CORDIC_INPUT_SHIFT);
+        y = _mm256_slli_epi32(y, CORDIC_INPUT_SHIFT);
+        __m256i left = _mm256_srai_epi32(x, 31);
+        z = _mm256_and_si256(left, negateIfAVX2(_mm256_set1_epi32(t.cordic_pi), _mm256_srai_epi32(y, 31)));
+        x = negateIfAVX2(x, left);
+        y = negateIfAVX2(y, left);
+        for(int k=0; k<iterations; k++) {
+            __m128i shift = _mm_cvtsi32_si128(k);
+            __m256i up = _mm256_srai_epi32(y, 31);
+            __m256i dx = negateIfAVX2(_mm256_sra_epi32(y, shift), up);
+            __m256i dy = negateIfAVX2(_mm256_sra_epi32(x, shift), up);
+            x = _mm256_add_epi32(x, dx);
+            y = _mm256_sub_epi32(y, dy);
+            z = _mm256_add_epi32(z, negateIfAVX2(_mm256_set1_epi32(t.cordic_atan[k]), up));
+        }
+        z = _mm256_srai_epi32(_mm256_add_epi32(z, _mm256_set1_epi32(1 << (CORDIC_PHASE_BITS - 1))), CORDIC_PHASE_BITS);
+        amp = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(t.cordic_scale[iterations])));
+    }
+
+    GESTURECAM_TARGET_AVX2
+    static void cordicBatchAVX2(const FastAtan2Tables &t, const int16_t *y, const int16_t *x,
+                                int16_t *phase, uint16_t *amplitude, int n, int iterations) {
+        int i = 0;
+        for(; i + 16 <= n; i += 16) {
+            __m256i Y = _mm256_loadu_si256((const __m256i *)(y + i));
+            __m256i X = _mm256_loadu_si256((const __m256i *)(x + i));
+            __m256i zlo, zhi, alo, ahi;
+            cordicAVX2(t, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(Y)), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(X)),
+                iterations, zlo, alo);
+            cordicAVX2(t, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(Y, 1)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(X, 1)),
+                iterations, zhi, ahi);
+            /* packs/packus work per 128-bit lane; restore element order */
+            if(phase)
+                _mm256_storeu_si256((__m256i *)(phase + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(zlo, zhi), 0xd8));
+            if(amplitude)
+                _mm256_storeu_si256((__m256i *)(amplitude + i), _mm256_permute4x64_epi64(_mm256_packus_epi32(alo, ahi), 0xd8));
+        }
+        cordicPixels(t, y, x, phase, amplitude, i, n, iterations);
+    }
+#endif
+
+#ifdef GESTURECAM_HAVE_NEON
+    static inline float32x4_t atan2PolyNEON(float32x4_t y, float32x4_t x) {
+        float32x4_t ax = vabsq_f32(x);
+        float32x4_t ay = vabsq_f32(y);
+        float32x4_t mn = vminq_f32(ax, ay);
+        float32x4_t mx = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(1.0f));
+#if defined(__aarch64__)
+        float32x4_t t = vdivq_f32(mn, mx);
+#else
+        /* No vector divide on ARMv7: refine the reciprocal estimate twice */
+        float32x4_t r = vrecpeq_f32(mx);
+        r = vmulq_f32(r, vrecpsq_f32(mx, r));
+        r = vmulq_f32(r, vrecpsq_f32(mx, r));
+        float32x4_t t = vmulq_f32(mn, r);
+#endif
+        float32x4_t t2 = vmulq_f32(t, t);
+        float32x4_t p = vmlaq_n_f32(vdupq_n_f32(ATAN_POLY_A7), t2, ATAN_POLY_A9);
+        p = vmlaq_f32(vdupq_n_f32(ATAN_POLY_A5), t2, p);
+        p = vmlaq_f32(vdupq_n_f32(ATAN_POLY_A3), t2, p);
+        p = vmlaq_f32(vdupq_n_f32(ATAN_POLY_A1), t2, p);
+        p = vmulq_f32(t, p);
+        p = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32((float)(M_PI/2)), p), p);
+        p = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0.0f)), vsubq_f32(vdupq_n_f32((float)M_PI), p), p);
+        p = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(p),
+            vandq_u32(vreinterpretq_u32_f32(y), vdupq_n_u32(0x80000000))));
+        return vmulq_n_f32(p, (float)ATAN_SCALE);
+    }
+
+    static inline int32x4_t roundNEON(float32x4_t v) {
+#if defined(__aarch64__)
+        return vcvtnq_s32_f32(v);
+#else
+        /* Round half away from zero, unlike lrintf(): results may differ by 1 on exact ties */
+        float32x4_t half = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(vdupq_n_f32(0.5f)),
+            vandq_u32(vreinterpretq_u32_f32(v), vdupq_n_u32(0x80000000))));
+        return vcvtq_s32_f32(vaddq_f32(v, half));
+#endif
+    }
+
+    static void atan2BatchNEON(const int16_t *y, const int16_t *x, int16_t *phase, uint16_t *amplitude, int n) {
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            int16x8_t Y = vld1q_s16(y + i);
+            int16x8_t X = vld1q_s16(x + i);
+            float32x4_t ylo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(Y)));
+            float32x4_t yhi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(Y)));
+            float32x4_t xlo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(X)));
+            float32x4_t xhi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(X)));
+            int32x4_t lo = roundNEON(atan2PolyNEON(ylo, xlo));
+            int32x4_t hi = roundNEON(atan2PolyNEON(yhi, xhi));
+            vst1q_s16(phase + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+            if(amplitude)
+                vst1q_u16(amplitude + i, vreinterpretq_u16_s16(vaddq_s16(vabsq_s16(Y), vabsq_s16(X))));
+        }
+        atan2PolyPixels(y, x, phase, amplitude, i, n);
+    }
+
+    static inline int32x4_t negateIfNEON(int32x4_t v, int32x4_t mask) {
+        return vsubq_s32(veorq_s32(v, mask), mask);
+    }
+
+    /* Four pairs, as int32, to phase and amplitude (both int32) */
+    static inline void cordicNEON(const FastAtan2Tables &t, int32x4_t y, int32x4_t x, int iterations, int32x4_t &z, int32x4_t &amp) {
+        x = vshlq_n_s32(x, CORDIC_INPUT_SHIFT);
+        y = vshlq_n_s32(y, CORDIC_INPUT_SHIFT);
+        int32x4_t left = vshrq_n_s32(x, 31);
+        z = vandq_s32(left, negateIfNEON(vdupq_n_s32(t.cordic_pi), vshrq_n_s32(y, 31)));
+        x = negateIfNEON(x, left);
+        y = negateIfNEON(y, left);
+        for(int k=0; k<iterations; k++) {
+            int32x4_t shift = vdupq_n_s32(-k); /* negative: arithmetic right shift */
+            int32x4_t up = vshrq_n_s32(y, 31);
+            int32x4_t dx = negateIfNEON(vshlq_s32(y, shift), up);
+            int32x4_t dy = negateIfNEON(vshlq_s32(x, shift), up);
+            x = vaddq_s32(x, dx);
+            y = vsubq_s32(y, dy);
+            z = vaddq_s32(z, negateIfNEON(vdupq_n_s32(t.cordic_atan[k]), up));
+        }
+        z = vshrq_n_s32(vaddq_s32(z, vdupq_n_s32(1 << (CORDIC_PHASE_BITS - 1))), CORDIC_PHASE_BITS);
+        amp = roundNEON(vmulq_n_f32(vcvtq_f32_s32(x), t.cordic_scale[iterations]));
+    }
+
+    static void cordicBatchNEON(const FastAtan2Tables &t, const int16_t *y, const int16_t *x,
+                                int16_t *phase, uint16_t *amplitude, int n, int iterations) {
+        int i = 0;
+        for(; i + 8 <= n; i += 8) {
+            int16x8_t Y = vld1q_s16(y + i);
+            int16x8_t X = vld1q_s16(x + i);
+            int32x4_t zlo, zhi, alo, ahi;
+            cordicNEON(t, vmovl_s16(vget_low_s16(Y)), vmovl_s16(vget_low_s16(X)), iterations, zlo, alo);
+            cordicNEON(t, vmovl_s16(vget_high_s16(Y)), vmovl_s16(vget_high_s16(X)), iterations, zhi, ahi);
+            if(phase)
+                vst1q_s16(phase + i, vcombine_s16(vqmovn_s32(zlo), vqmovn_s32(zhi)));
+            if(amplitude)
+                vst1q_u16(amplitude + i, vcombine_u16(vqmovun_s32(alo), vqmovun_s32(ahi)));
+        }
+        cordicPixels(t, y, x, phase, amplitude, i, n, iterations);
+    }
+#endif
 };
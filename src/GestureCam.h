@@ -114,7 +114,8 @@ public:
         return res;
     }
 
-    uvc_error_t start_video(uvc_frame_callback_t cb, void *userdata, int width=1280, int height=720, int fps=30) {
+    uvc_error_t start_video(uvc_frame_callback_t cb, void *userdata, int width=1280, int height=720, int fps=30,
+            enum uvc_frame_format format=UVC_FRAME_FORMAT_ANY) {
         if(video_stream) {
             return UVC_ERROR_INVALID_MODE;
         }
@@ -124,7 +125,7 @@ public:
 
         res = uvc_get_stream_ctrl_format_size(
             devh, &ctrl,
-            UVC_FRAME_FORMAT_ANY, width, height, fps
+            format, width, height, fps
         );
         if(res < 0) {
             uvc_perror(res, "video: uvc_get_stream_ctrl_format_size");
@@ -153,6 +154,23 @@ public:
         return res;
     }
 
+    /* Does the device offer this video mode? Sends a probe request, so the
+       video stream should be stopped. */
+    bool probe_video_mode(enum uvc_frame_format format, int width, int height, int fps) {
+        uvc_stream_ctrl_t ctrl;
+        return uvc_get_stream_ctrl_format_size(devh, &ctrl, format, width, height, fps) == UVC_SUCCESS;
+    }
+
+    /* Switch a running depth stream between 30 and 60 fps. The rate is the only
+       difference in init_depthcam, so only that register is rewritten; the USB
+       bandwidth reserved when the stream started is kept. */
+    uvc_error_t set_depth_fps(int fps) {
+        if(!depth_stream) {
+            return UVC_ERROR_INVALID_MODE;
+        }
+        return write_reg(0x12, depth_fps_reg(fps));
+    }
+
     void stop_depth() {
         if(depth_stream) {
             uvc_stream_close(depth_stream);
@@ -167,7 +185,7 @@ public:
         }
     }
 
-private:
+    /* Read len bytes of the calibration ROM, starting at startaddr */
     uvc_error_t read_rom(uint8_t *buf, uint16_t startaddr, int len) {
         uint8_t cmdbuf[33];
         uvc_error_t res;
@@ -239,6 +257,7 @@ private:
         return UVC_SUCCESS;
     }
 
+private:
     uvc_error_t _read_op(uint8_t op, uint16_t reg, uint16_t *ret) {
         uint8_t cmdbuf[7];
         uvc_error_t res;
@@ -369,7 +388,7 @@ private:
         write_reg(0x0f, 0x0000);
         write_reg(0x10, 0x0000);
         write_reg(0x11, 0x01e0);
-        write_reg(0x12, (fps == 60) ? 2 : 4); // 2 for 60fps, 4 for 30fps
+        write_reg(0x12, depth_fps_reg(fps));
         write_reg(0x1a, 0x1400);
         write_reg(0x33, 0x70f0);
         write_reg(0x4a, 0x0002);
@@ -377,6 +396,10 @@ private:
         write_reg(0x1a, 0x14c0);
     }
 
+    static uint16_t depth_fps_reg(int fps) {
+        return (fps == 60) ? 2 : 4; // 2 for 60fps, 4 for 30fps
+    }
+
     void deinit_depthcam() {
         if(get_fpga_state() != 2)
             return;
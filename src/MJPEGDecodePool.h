@@ -0,0 +1,206 @@
+/* MJPEGDecodePool.h, copyright (c) 2014 Robert Xiao
+
+Decodes MJPEG frames on several worker threads and delivers them in arrival order.
+
+The USB callback only copies each compressed frame into a free slot and returns,
+so a slow decode never holds up libuvc's transfer processing. Workers take frames
+in arrival order and may finish out of order; each finished frame is held until
+every earlier frame has been delivered. If frames arrive faster than the workers
+can decode them, the oldest frame still waiting for a worker is dropped in favour
+of the new one.
+
+Frames that don't need decoding right now can still be submitted, to be passed
+through undecoded. Since everything then arrives through the pool, in order,
+the consumer of the deliveries never has a second producer to race with.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ofxGestureCam.h"
+#include "MJPEGDecoder.h"
+
+class MJPEGDecodePool {
+public:
+    struct Job {
+        std::vector<unsigned char> compressed;
+        ofPixels pixels;
+        ofxGestureCam::FrameInfo info;
+        bool decode; /* false: passed through, and pixels are not filled in */
+        bool ok; /* false if the frame could not be decoded */
+    };
+
+    /* Called with each job in arrival order, never for two jobs at once.
+       May swap out the job's pixels and compressed data. */
+    typedef void (*DeliverFn)(void *userdata, Job &job);
+
+private:
+    enum State { FREE, QUEUED, DECODING, DONE };
+    struct Slot {
+        Job job;
+        State state;
+        uint64_t ticket;
+    };
+
+    std::vector<Slot> slots;
+    std::deque<int> queue; /* QUEUED slots, oldest first */
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool quit;
+    bool delivering;
+    uint64_t nextTicket;
+    uint64_t nextDeliver;
+
+    DeliverFn deliverFn;
+    void *deliverUserdata;
+    MJPEGDecoder::Output output;
+
+public:
+    MJPEGDecodePool() : quit(false), delivering(false), nextTicket(0), nextDeliver(0),
+        deliverFn(NULL), deliverUserdata(NULL) {
+    }
+
+    ~MJPEGDecodePool() {
+        stop();
+    }
+
+    bool isRunning() const {
+        return !threads.empty();
+    }
+
+    /* Decode frames into the crop of output, using numThreads workers */
+    void start(int numThreads, const MJPEGDecoder::Output &output, DeliverFn fn, void *userdata) {
+        stop();
+        if(numThreads <= 0)
+            return;
+
+        this->output = output;
+        deliverFn = fn;
+        deliverUserdata = userdata;
+
+        /* One frame per worker, plus one waiting and one awaiting delivery */
+        slots.resize(numThreads + 2);
+        for(size_t i=0; i<slots.size(); i++) {
+            slots[i].job.pixels.allocate(output.cropWidth, output.cropHeight, output.getChannels());
+            slots[i].state = FREE;
+        }
+        for(int i=0; i<numThreads; i++)
+            threads.push_back(std::thread(&MJPEGDecodePool::workerMain, this));
+    }
+
+    /* No more frames may be submitted. Waits for frames being decoded, and drops the rest. */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cond.notify_all();
+        for(size_t i=0; i<threads.size(); i++)
+            threads[i].join();
+        threads.clear();
+        slots.clear();
+        queue.clear();
+        quit = false;
+        delivering = false;
+        nextTicket = 0;
+        nextDeliver = 0;
+    }
+
+    /* Queue a compressed frame, to be decoded or (with decode false) just delivered in order.
+       Never waits for decoding. Returns the number of frames (0 or 1) dropped to make room. */
+    int submit(const unsigned char *data, size_t size, const ofxGestureCam::FrameInfo &info, bool decode=true) {
+        int dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int slot = -1;
+            for(size_t i=0; i<slots.size(); i++) {
+                if(slots[i].state == FREE) {
+                    slot = i;
+                    break;
+                }
+            }
+            if(slot < 0 && !queue.empty()) {
+                /* The oldest waiting frame is stale by now */
+                slot = queue.front();
+                queue.pop_front();
+                dropped = 1;
+            }
+            if(slot < 0)
+                return 1;
+
+            slots[slot].job.compressed.assign(data, data + size);
+            slots[slot].job.info = info;
+            slots[slot].job.decode = decode;
+            slots[slot].state = QUEUED;
+            queue.push_back(slot);
+        }
+        cond.notify_one();
+        return dropped;
+    }
+
+private:
+    void workerMain() {
+        MJPEGDecoder decoder;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for(;;) {
+            cond.wait(lock, [this]{ return quit || !queue.empty(); });
+            if(quit)
+                return;
+
+            /* Tickets are handed out in arrival order, and only to frames that get decoded */
+            Slot &slot = slots[queue.front()];
+            queue.pop_front();
+            slot.state = DECODING;
+            slot.ticket = nextTicket++;
+
+            lock.unlock();
+            Job &job = slot.job;
+            job.ok = !job.decode || decoder.decode(job.compressed.data(), job.compressed.size(),
+                job.pixels.getPixels(), output.cropWidth * output.getChannels(), output);
+            lock.lock();
+
+            slot.state = DONE;
+            deliverReady(lock);
+        }
+    }
+
+    /* Deliver finished frames in ticket order. Only one thread delivers at a time;
+       frames finished meanwhile are picked up by its loop. */
+    void deliverReady(std::unique_lock<std::mutex> &lock) {
+        if(delivering)
+            return;
+        delivering = true;
+        for(;;) {
+            int next = -1;
+            for(size_t i=0; i<slots.size(); i++) {
+                if(slots[i].state == DONE && slots[i].ticket == nextDeliver) {
+                    next = i;
+                    break;
+                }
+            }
+            if(next < 0)
+                break;
+
+            lock.unlock();
+            deliverFn(deliverUserdata, slots[next].job);
+            lock.lock();
+
+            slots[next].state = FREE;
+            nextDeliver++;
+        }
+        delivering = false;
+    }
+
+    /* Forbid copying */
+    /* Copy constructor */
+    MJPEGDecodePool(const MJPEGDecodePool &that);
+    /* Copy assignment */
+    MJPEGDecodePool& operator=(MJPEGDecodePool that);
+};
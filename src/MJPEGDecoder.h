@@ -0,0 +1,216 @@
+/* MJPEGDecoder.h, copyright (c) 2014 Robert Xiao
+
+Persistent libjpeg decompressor for UVC MJPEG frames.
+
+uvc_mjpeg2rgb creates and destroys a decompression object for every frame. This
+keeps one object per stream instead, so its allocations survive from frame to
+frame, and decodes straight into the destination pixels.
+
+UVC MJPEG frames usually omit the Huffman tables (DHT) and rely on the standard
+tables from the JPEG spec (ITU T.81, K.3). libjpeg keeps tables in the
+decompression object between images, so the standard tables only need to be
+installed once; frames that carry their own tables simply replace them.
+
+The bundled libjpeg can't skip scanlines or decode a column range, so a cropped
+decode still runs every row above the crop, but stops as soon as the last
+cropped row is out, and only copies the cropped columns.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <vector>
+#include "jpeglib.h"
+
+class MJPEGDecoder {
+    struct ErrorManager {
+        struct jpeg_error_mgr pub;
+        jmp_buf jmp;
+    };
+
+    struct jpeg_decompress_struct dinfo;
+    ErrorManager jerr;
+    std::vector<uint8_t> rowBuffer; /* rows outside the crop */
+
+public:
+    /* Size and layout of the decoded image */
+    struct Output {
+        int width, height; /* frame size divided by scale, rounded up */
+        int scale;         /* 1, 2, 4 or 8, applied during the IDCT */
+        bool luma;         /* one byte (Y) per pixel instead of RGB */
+        int cropX, cropY, cropWidth, cropHeight; /* the part of the image that is stored */
+
+        Output(int width=0, int height=0, int scale=1, bool luma=false) : width(width), height(height),
+            scale(scale), luma(luma), cropX(0), cropY(0), cropWidth(width), cropHeight(height) {
+        }
+
+        int getChannels() const {
+            return luma ? 1 : 3;
+        }
+    };
+
+    MJPEGDecoder() {
+        dinfo.err = jpeg_std_error(&jerr.pub);
+        jerr.pub.error_exit = errorExit;
+        jerr.pub.output_message = outputMessage;
+        jpeg_create_decompress(&dinfo);
+    }
+
+    ~MJPEGDecoder() {
+        jpeg_destroy_decompress(&dinfo);
+    }
+
+    /* Decode the crop of one frame into dst, stride bytes per row.
+       With luma output, libjpeg skips the chroma components' IDCT and the colour conversion.
+       Returns false if the frame is corrupt or does not have the expected size. */
+    bool decode(const uint8_t *data, size_t size, uint8_t *dst, int stride, const Output &out) {
+        if(setjmp(jerr.jmp)) {
+            jpeg_abort_decompress(&dinfo);
+            return false;
+        }
+
+        jpeg_mem_src(&dinfo, const_cast<unsigned char *>(data), size);
+        jpeg_read_header(&dinfo, TRUE);
+        if(dinfo.dc_huff_tbl_ptrs[0] == NULL)
+            insertStandardHuffmanTables();
+
+        dinfo.out_color_space = out.luma ? JCS_GRAYSCALE : JCS_RGB;
+        dinfo.dct_method = JDCT_IFAST;
+        dinfo.scale_num = 1;
+        dinfo.scale_denom = out.scale;
+        jpeg_calc_output_dimensions(&dinfo);
+        if((int)dinfo.output_width != out.width || (int)dinfo.output_height != out.height) {
+            jpeg_abort_decompress(&dinfo);
+            return false;
+        }
+
+        jpeg_start_decompress(&dinfo);
+
+        /* Full-width rows inside the crop are decoded in place; everything else goes
+           through the row buffer */
+        int channels = out.getChannels();
+        int rowBytes = out.width * channels;
+        bool inPlace = (out.cropX == 0 && out.cropWidth == out.width);
+        if(rowBuffer.size() < (size_t)rowBytes * 16)
+            rowBuffer.resize(rowBytes * 16);
+
+        unsigned cropEnd = out.cropY + out.cropHeight;
+        JSAMPROW rows[16];
+        while(dinfo.output_scanline < cropEnd) {
+            int y0 = dinfo.output_scanline;
+            int count = cropEnd - y0;
+            if(count > 16)
+                count = 16;
+            /* Don't let a batch straddle the top of the crop */
+            if(y0 < out.cropY && y0 + count > out.cropY)
+                count = out.cropY - y0;
+            bool direct = inPlace && y0 >= out.cropY;
+            for(int i=0; i<count; i++)
+                rows[i] = direct ? dst + (y0 - out.cropY + i) * stride : &rowBuffer[i * rowBytes];
+            count = jpeg_read_scanlines(&dinfo, rows, count);
+            if(!direct && y0 >= out.cropY) {
+                for(int i=0; i<count; i++)
+                    memcpy(dst + (y0 - out.cropY + i) * stride, rows[i] + out.cropX * channels, out.cropWidth * channels);
+            }
+        }
+        if(dinfo.output_scanline < dinfo.output_height)
+            jpeg_abort_decompress(&dinfo); /* skip the rest of the frame */
+        else
+            jpeg_finish_decompress(&dinfo);
+        return true;
+    }
+
+private:
+    static void errorExit(j_common_ptr cinfo) {
+        ErrorManager *err = reinterpret_cast<ErrorManager *>(cinfo->err);
+        longjmp(err->jmp, 1);
+    }
+
+    static void outputMessage(j_common_ptr cinfo) {
+        /* Corrupt frames are counted by the caller; don't spam stderr at 30 fps */
+    }
+
+    static void setHuffmanTable(j_decompress_ptr dinfo, JHUFF_TBL **table, const UINT8 *bits, const UINT8 *values, int numValues) {
+        if(*table == NULL)
+            *table = jpeg_alloc_huff_table(reinterpret_cast<j_common_ptr>(dinfo));
+        memcpy((*table)->bits, bits, sizeof((*table)->bits));
+        memset((*table)->huffval, 0, sizeof((*table)->huffval));
+        memcpy((*table)->huffval, values, numValues);
+        (*table)->sent_table = FALSE;
+    }
+
+    void insertStandardHuffmanTables() {
+        static const UINT8 bits_dc_luminance[17] =
+            { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+        static const UINT8 val_dc_luminance[] =
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+        static const UINT8 bits_dc_chrominance[17] =
+            { 0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+        static const UINT8 val_dc_chrominance[] =
+            { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+        static const UINT8 bits_ac_luminance[17] =
+            { 0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+        static const UINT8 val_ac_luminance[] =
+            { 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+              0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+              0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+              0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+              0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+              0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+              0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+              0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+              0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+              0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+              0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+              0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+              0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+              0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+              0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+              0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+              0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+              0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+              0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+              0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+              0xf9, 0xfa };
+
+        static const UINT8 bits_ac_chrominance[17] =
+            { 0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+        static const UINT8 val_ac_chrominance[] =
+            { 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+              0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+              0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+              0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+              0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+              0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+              0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+              0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+              0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+              0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+              0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+              0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+              0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+              0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+              0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+              0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+              0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+              0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+              0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+              0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+              0xf9, 0xfa };
+
+        setHuffmanTable(&dinfo, &dinfo.dc_huff_tbl_ptrs[0], bits_dc_luminance, val_dc_luminance, sizeof(val_dc_luminance));
+        setHuffmanTable(&dinfo, &dinfo.ac_huff_tbl_ptrs[0], bits_ac_luminance, val_ac_luminance, sizeof(val_ac_luminance));
+        setHuffmanTable(&dinfo, &dinfo.dc_huff_tbl_ptrs[1], bits_dc_chrominance, val_dc_chrominance, sizeof(val_dc_chrominance));
+        setHuffmanTable(&dinfo, &dinfo.ac_huff_tbl_ptrs[1], bits_ac_chrominance, val_ac_chrominance, sizeof(val_ac_chrominance));
+    }
+
+    /* Forbid copying */
+    /* Copy constructor */
+    MJPEGDecoder(const MJPEGDecoder &that);
+    /* Copy assignment */
+    MJPEGDecoder& operator=(MJPEGDecoder that);
+};
@@ -0,0 +1,34 @@
+/* SIMD.h, copyright (c) 2014 Robert Xiao
+
+Compile-time SIMD availability and runtime CPU feature checks.
+
+On x86, SSE2 is assumed whenever the compiler targets it (always true on x86-64),
+and AVX2 kernels are compiled with per-function target attributes and selected at
+runtime. On ARM, NEON kernels are used whenever the compiler targets NEON
+(always true on AArch64, and on ARMv7 builds with -mfpu=neon).
+*/
+#pragma once
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GESTURECAM_HAVE_SSE2 1
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5)
+#include <immintrin.h>
+#define GESTURECAM_HAVE_AVX2 1
+#define GESTURECAM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GESTURECAM_HAVE_NEON 1
+#endif
+
+static inline bool cpuHasAVX2() {
+#ifdef GESTURECAM_HAVE_AVX2
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
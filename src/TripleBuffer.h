@@ -0,0 +1,110 @@
+/* TripleBuffer.h, copyright (c) 2014 Robert Xiao
+
+Wait-free single-producer/single-consumer triple buffer.
+
+The producer (a USB callback) always owns the back buffer and the consumer (the
+app thread) always owns the front buffer. The third, pending buffer is handed
+between them by atomically exchanging its index, together with a flag that says
+whether it holds a frame the consumer has not seen yet. Neither side ever waits
+for the other.
+*/
+#pragma once
+
+#include <atomic>
+
+template <typename T> class TripleBuffered {
+    static const unsigned INDEX_MASK = 3;
+    static const unsigned FRESH = 4;
+
+    T buffers[3];
+    unsigned frontIndex; /* owned by the consumer */
+    unsigned backIndex; /* owned by the producer */
+    std::atomic<unsigned> pendingState; /* pending buffer index | FRESH */
+
+public:
+    TripleBuffered() {
+        reset();
+    }
+
+    /* Front buffer: for use by the consumer */
+    T &front() { return buffers[frontIndex]; }
+    const T &front() const { return buffers[frontIndex]; }
+
+    /* Back buffer: for use by the producer */
+    T &back() { return buffers[backIndex]; }
+
+    /* All three buffers, for (re)allocation. Only touch buffers that the producer
+       may be using while it is stopped, or under a lock shared with it. */
+    T &buffer(int i) { return buffers[i]; }
+
+    /* Is a new frame waiting for swapFront()? */
+    bool isUpdated() const {
+        return (pendingState.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+
+    /* Producer: publish the back buffer as the newest frame.
+       Returns true if this overwrote a frame that the consumer never saw. */
+    bool swapBack() {
+        unsigned old = pendingState.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        backIndex = old & INDEX_MASK;
+        return (old & FRESH) != 0;
+    }
+
+    /* Consumer: take the newest frame as the front buffer.
+       Returns false (and keeps the current front) if there is no new frame. */
+    bool swapFront() {
+        if(!isUpdated())
+            return false;
+        unsigned old = pendingState.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = old & INDEX_MASK;
+        return true;
+    }
+
+    /* Forget any pending frame. Neither side may be running. */
+    void reset() {
+        frontIndex = 0;
+        backIndex = 1;
+        pendingState.store(2, std::memory_order_release);
+    }
+
+private:
+    /* Forbid copying */
+    /* Copy constructor */
+    TripleBuffered(const TripleBuffered &that);
+    /* Copy assignment */
+    TripleBuffered& operator=(TripleBuffered that);
+};
+
+template <typename T> class TripleBufferedPixels : public TripleBuffered<T> {
+    bool allocated;
+
+public:
+    TripleBufferedPixels() : allocated(false) {
+    }
+
+    /* The producer must be stopped. */
+    void allocate(int width, int height, int bpp) {
+        if(allocated)
+            return;
+
+        allocated = true;
+        for(int i=0; i<3; i++)
+            this->buffer(i).allocate(width, height, bpp);
+        this->reset();
+    }
+
+    /* The producer must be stopped. */
+    void clear() {
+        if(!allocated)
+            return;
+
+        allocated = false;
+        for(int i=0; i<3; i++)
+            this->buffer(i).clear();
+        this->reset();
+    }
+
+    bool isAllocated() const {
+        return allocated;
+    }
+};
@@ -0,0 +1,181 @@
+/* WorkerPool.h, copyright (c) 2014 Robert Xiao
+
+A small pool of persistent worker threads for splitting per-frame work into bands.
+Threads are created only when the pool size changes, never per frame. The calling
+thread always works on bands too, so a pool with zero threads just runs everything
+inline.
+*/
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    /* Processes one band of a job; bands are numbered [0, numBands). */
+    typedef void (*BandFn)(void *userdata, int band, int numBands);
+
+private:
+    std::vector<std::thread> threads;
+    /* threads.size(), readable without runMutex */
+    std::atomic<int> numThreads;
+
+    /* Serializes run() and setNumThreads() */
+    std::mutex runMutex;
+
+    /* Guards the job description and the counters below */
+    std::mutex mutex;
+    std::condition_variable startCond;
+    std::condition_variable doneCond;
+
+    BandFn jobFn;
+    void *jobUserdata;
+    int jobBands;
+    unsigned generation;
+    int activeWorkers;
+    int doneBands;
+    bool quit;
+
+    std::atomic<int> nextBand;
+
+public:
+    WorkerPool(int numThreads=0) : numThreads(0), jobFn(NULL), jobUserdata(NULL), jobBands(0),
+        generation(0), activeWorkers(0), doneBands(0), quit(false), nextBand(0) {
+        setNumThreads(numThreads);
+    }
+
+    ~WorkerPool() {
+        setNumThreads(0);
+    }
+
+    /* Number of threads in addition to the caller of run() */
+    void setNumThreads(int numThreads) {
+        std::lock_guard<std::mutex> runLock(runMutex);
+        if(numThreads < 0)
+            numThreads = 0;
+        if(numThreads == (int)threads.size())
+            return;
+
+        stopThreads();
+        for(int i=0; i<numThreads; i++)
+            threads.push_back(std::thread(&WorkerPool::workerMain, this));
+        this->numThreads = numThreads;
+    }
+
+    /* May be stale by the time it is used; to match the bands to the threads, pass numBands=0 to run() */
+    int getNumThreads() const {
+        return numThreads;
+    }
+
+    /* Call fn for every band and wait for all of them to finish.
+       numBands=0 means one band per thread plus one for the caller. */
+    void run(BandFn fn, void *userdata, int numBands=0) {
+        std::lock_guard<std::mutex> runLock(runMutex);
+        runLocked(fn, userdata, numBands);
+    }
+
+    /* As run(), but never waits for another caller's job or setNumThreads():
+       if the pool is busy, the calling thread processes every band itself.
+       For threads that must not block, like the USB callbacks. */
+    void runNoWait(BandFn fn, void *userdata, int numBands=0) {
+        std::unique_lock<std::mutex> runLock(runMutex, std::try_to_lock);
+        if(!runLock.owns_lock()) {
+            if(numBands <= 0)
+                numBands = 1;
+            for(int band=0; band<numBands; band++)
+                fn(userdata, band, numBands);
+            return;
+        }
+        runLocked(fn, userdata, numBands);
+    }
+
+private:
+    /* Must be called with runMutex held */
+    void runLocked(BandFn fn, void *userdata, int numBands) {
+        if(numBands <= 0)
+            numBands = threads.size() + 1;
+        if(threads.empty() || numBands <= 1) {
+            for(int band=0; band<numBands; band++)
+                fn(userdata, band, numBands);
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            /* A worker that woke up late for the previous job may still be
+               draining its (exhausted) band counter. */
+            doneCond.wait(lock, [this]{ return activeWorkers == 0; });
+            jobFn = fn;
+            jobUserdata = userdata;
+            jobBands = numBands;
+            doneBands = 0;
+            nextBand = 0;
+            generation++;
+        }
+        startCond.notify_all();
+
+        runBands(fn, userdata, numBands);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCond.wait(lock, [this]{ return doneBands == jobBands; });
+    }
+
+    void runBands(BandFn fn, void *userdata, int numBands) {
+        int band;
+        while((band = nextBand++) < numBands) {
+            fn(userdata, band, numBands);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(++doneBands == numBands)
+                doneCond.notify_all();
+        }
+    }
+
+    void workerMain() {
+        unsigned seen = 0;
+        for(;;) {
+            BandFn fn;
+            void *userdata;
+            int numBands;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                startCond.wait(lock, [&]{ return quit || generation != seen; });
+                if(quit)
+                    return;
+                seen = generation;
+                fn = jobFn;
+                userdata = jobUserdata;
+                numBands = jobBands;
+                activeWorkers++;
+            }
+
+            runBands(fn, userdata, numBands);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--activeWorkers == 0)
+                doneCond.notify_all();
+        }
+    }
+
+    /* Must be called with runMutex held */
+    void stopThreads() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        startCond.notify_all();
+        for(size_t i=0; i<threads.size(); i++)
+            threads[i].join();
+        threads.clear();
+        quit = false;
+    }
+
+    /* Forbid copying */
+    /* Copy constructor */
+    WorkerPool(const WorkerPool &that);
+    /* Copy assignment */
+    WorkerPool& operator=(WorkerPool that);
+};
@@ -24,16 +24,39 @@
 #include "ofxGestureCam.h"
 #include "ofMain.h"
 
+#include "ColorConvert.h"
+#include "DepthCalibration.h"
+#include "DepthColormap.h"
+#include "DepthDecoder.h"
 #include "FastAtan2.h"
 #include "GestureCam.h"
 #include "Log.h"
-
+#include "MJPEGDecodePool.h"
+#include "MJPEGDecoder.h"
+#include "TripleBuffer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <mutex>
+#include <thread>
 
 #define CREATIVE_VID   0x041e
 #define GESTURECAM_PID 0x4096
 
-#define PHASE_TO_DISTANCE_FACTOR 11.31032
+#define PHASE_TO_DISTANCE_FACTOR 11.31032 /* phase units per mm */
+#define DEPTH_FOV_X 74 /* nominal field of view, degrees */
+#define DEPTH_FOV_Y 58
+#define DEPTH_PHASE_OFFSET -16384 /* phases span +-16384 (+-pi); wrap only at the ends */
+
+ofxGestureCam::DistanceCalibration::DistanceCalibration() : phaseOffset(DEPTH_PHASE_OFFSET),
+    mmPerPhase(1 / PHASE_TO_DISTANCE_FACTOR), radialToZ(true),
+    fx(depth_width / 2 / tan(DEPTH_FOV_X * M_PI / 360)), fy(depth_height / 2 / tan(DEPTH_FOV_Y * M_PI / 360)),
+    cx((depth_width - 1) / 2.0f), cy((depth_height - 1) / 2.0f) {
+}
 
 struct Bool {
     bool val;
@@ -50,64 +73,326 @@ struct Bool {
     }
 };
 
-template <typename T> struct TripleBufferedPixels {
-    T front; /* Front buffer: for use by the main app */
-    T back; /* Back buffer: ready to be written to any time */
-    T pending; /* Pending buffer: ready to be swapped in as the new front */
-    bool allocated;
-    bool updated;
+/* Frame counters for one stream. Updated by the stream's callback and by update(). */
+struct StreamCounters {
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> invalid;
+    std::atomic<uint64_t> usbGaps;
+    std::atomic<uint64_t> decoded;
+    std::atomic<uint64_t> overwritten;
+    std::atomic<uint64_t> consumed;
+    std::atomic<uint64_t> unpaired;
+
+    /* Only touched by the callback, or while the stream is stopped */
+    bool haveSequence;
+    uint32_t lastSequence;
+
+    StreamCounters() : haveSequence(false), lastSequence(0) {
+        reset();
+    }
+
+    void reset() {
+        received = 0;
+        invalid = 0;
+        usbGaps = 0;
+        decoded = 0;
+        overwritten = 0;
+        consumed = 0;
+        unpaired = 0;
+    }
 
-    TripleBufferedPixels() : allocated(false), updated(false) {
+    /* Call from the callback for every frame that libuvc delivers */
+    void receive(const uvc_frame_t *frame) {
+        received++;
+        /* Sequence numbers may skip, but only increase */
+        if(haveSequence && frame->sequence > lastSequence + 1)
+            usbGaps += frame->sequence - lastSequence - 1;
+        haveSequence = true;
+        lastSequence = frame->sequence;
     }
 
-    void allocate(int width, int height, int bpp) {
-        if(allocated)
-            return;
+    ofxGestureCam::StreamStats get() const {
+        ofxGestureCam::StreamStats stats;
+        stats.received = received;
+        stats.invalid = invalid;
+        stats.usbGaps = usbGaps;
+        stats.decoded = decoded;
+        stats.overwritten = overwritten;
+        stats.consumed = consumed;
+        stats.unpaired = unpaired;
+        return stats;
+    }
+};
+
+static inline ofxGestureCam::FrameInfo getFrameInfo(const uvc_frame_t *frame) {
+    ofxGestureCam::FrameInfo info;
+    info.sequence = frame->sequence;
+    info.timestamp = (uint64_t)frame->capture_time.tv_sec * 1000000 + frame->capture_time.tv_usec;
+    return info;
+}
+
+/* One raw depth frame together with the maps decoded from it */
+struct DepthFrame {
+    ofShortPixels raw;
+    ofxGestureCam::FrameInfo info;
+
+    ofShortPixels phaseMap;
+    ofShortPixels confidenceMap;
+    ofShortPixels distanceMap;
+    ofShortPixels rawIRIMap, rawIRQMap;
+    ofPixels rawIRIMap8, rawIRQMap8;
+    ofPixels depthRGBMap;
+
+    /* Output configuration that the maps were decoded with, or 0 if raw has not been decoded */
+    unsigned decodedGeneration;
+
+    /* Size of the maps: the decoder's region */
+    int mapWidth, mapHeight;
+    /* DepthOutputs whose maps are allocated */
+    unsigned enabledOutputs;
+
+    DepthFrame() : decodedGeneration(0), mapWidth(ofxGestureCam::depth_width), mapHeight(ofxGestureCam::depth_height),
+        enabledOutputs(0) {
+        info.sequence = 0;
+        info.timestamp = 0;
+    }
+
+    void setEnableRaw(bool use) {
+        use ? raw.allocate(ofxGestureCam::depth_width * 2, ofxGestureCam::depth_height, 1) : raw.clear();
+        decodedGeneration = 0;
+    }
+
+    /* Resize the maps that are allocated, and use the new size for maps enabled later */
+    void setMapSize(int width, int height) {
+        mapWidth = width;
+        mapHeight = height;
+        resizeMap(phaseMap);
+        resizeMap(confidenceMap);
+        resizeMap(distanceMap);
+        resizeMap(rawIRIMap);
+        resizeMap(rawIRQMap);
+        resizeMap(rawIRIMap8);
+        resizeMap(rawIRQMap8);
+        resizeMap(depthRGBMap);
+        decodedGeneration = 0;
+    }
+
+    /* Allocate or free the maps backing one DepthOutput */
+    void setEnableOutput(unsigned output, bool use) {
+        if(use)
+            enabledOutputs |= output;
+        else
+            enabledOutputs &= ~output;
+        switch(output) {
+        case DEPTH_OUTPUT_PHASE:
+            setEnableMap(phaseMap, use, 1);
+            break;
+        case DEPTH_OUTPUT_CONFIDENCE:
+            setEnableMap(confidenceMap, use, 1);
+            break;
+        case DEPTH_OUTPUT_DISTANCE:
+            setEnableMap(distanceMap, use, 1);
+            break;
+        case DEPTH_OUTPUT_RAW_IR:
+            setEnableMap(rawIRIMap, use, 1);
+            setEnableMap(rawIRQMap, use, 1);
+            break;
+        case DEPTH_OUTPUT_RGB:
+            setEnableMap(depthRGBMap, use, 3);
+            break;
+        case DEPTH_OUTPUT_RAW_IR8:
+            setEnableMap(rawIRIMap8, use, 1);
+            setEnableMap(rawIRQMap8, use, 1);
+            break;
+        }
+    }
 
-        allocated = true;
-        front.allocate(width, height, bpp);
-        back.allocate(width, height, bpp);
-        pending.allocate(width, height, bpp);
-        updated = false;
+    /* Bring the map size and the allocated outputs in line, touching only what differs */
+    void setLayout(int width, int height, unsigned outputs) {
+        if(width != mapWidth || height != mapHeight)
+            setMapSize(width, height);
+        for(unsigned output=1; output<DEPTH_OUTPUT_COMBINATIONS; output<<=1) {
+            if((outputs & output) != (enabledOutputs & output))
+                setEnableOutput(output, (outputs & output) != 0);
+        }
+    }
+
+    DepthOutputs getOutputs(const DepthColormap *colormap, const DepthDistanceLUT *distanceLUT) {
+        DepthOutputs out;
+        out.phase = (int16_t *)phaseMap.getPixels();
+        out.confidence = confidenceMap.getPixels();
+        out.distance = distanceMap.getPixels();
+        out.rawI = (int16_t *)rawIRIMap.getPixels();
+        out.rawQ = (int16_t *)rawIRQMap.getPixels();
+        out.rawI8 = rawIRIMap8.getPixels();
+        out.rawQ8 = rawIRQMap8.getPixels();
+        out.rgb = depthRGBMap.getPixels();
+        out.colormap = colormap;
+        out.distanceLUT = distanceLUT;
+        return out;
+    }
+
+    ofxGestureCam::DepthFrameData getData() {
+        ofxGestureCam::DepthFrameData data;
+        data.info = info;
+        data.phase = reinterpret_cast<short *>(phaseMap.getPixels());
+        data.confidence = confidenceMap.getPixels();
+        data.distance = distanceMap.getPixels();
+        data.rawIRI = reinterpret_cast<short *>(rawIRIMap.getPixels());
+        data.rawIRQ = reinterpret_cast<short *>(rawIRQMap.getPixels());
+        return data;
+    }
+
+    /* Decode raw into the maps, unless that has already been done for this output configuration.
+       Returns true if the frame was decoded. See DepthDecoder::decode() for wait. */
+    bool decode(const DepthDecoder &decoder, WorkerPool &pool, const DepthColormap *colormap,
+                const DepthDistanceLUT *distanceLUT, unsigned generation, bool wait=true) {
+        if(decodedGeneration == generation)
+            return false;
+        decoder.decode((const int16_t *)raw.getPixels(), getOutputs(colormap, distanceLUT), pool, wait);
+        decodedGeneration = generation;
+        return true;
+    }
+
+private:
+    template <typename PixelsT> void setEnableMap(PixelsT &map, bool use, int channels) {
+        if(use)
+            map.allocate(mapWidth, mapHeight, channels);
+        else
+            map.clear();
+    }
+
+    template <typename PixelsT> void resizeMap(PixelsT &map) {
+        if(map.isAllocated())
+            map.allocate(mapWidth, mapHeight, map.getNumChannels());
+    }
+};
+
+/* One colour frame, either decoded or still compressed */
+struct VideoFrame {
+    ofPixels pixels;
+    ofxGestureCam::FrameInfo info;
+
+    /* MJPEG payload, kept when decoding is deferred. Its capacity is reused from frame to frame. */
+    std::vector<unsigned char> compressed;
+    bool decoded;
+
+    VideoFrame() : decoded(true) {
+        info.sequence = 0;
+        info.timestamp = 0;
+    }
+
+    void allocate(int width, int height, int bpp) {
+        pixels.allocate(width, height, bpp);
+        decoded = true;
     }
 
     void clear() {
-        if(!allocated)
-            return;
+        pixels.clear();
+        std::vector<unsigned char>().swap(compressed);
+        decoded = true;
+    }
+
+    ofxGestureCam::VideoFrameData getData() {
+        ofxGestureCam::VideoFrameData data;
+        data.info = info;
+        data.pixels = pixels.getPixels();
+        return data;
+    }
+
+    ofxGestureCam::CompressedVideoFrame getCompressedData() const {
+        ofxGestureCam::CompressedVideoFrame data;
+        data.info = info;
+        data.data = compressed.empty() ? NULL : compressed.data();
+        data.size = compressed.size();
+        return data;
+    }
+};
 
-        allocated = false;
-        front.clear();
-        back.clear();
-        pending.clear();
-        updated = false;
+/* Registered listener callbacks of one kind */
+template <typename Fn> struct ListenerList {
+    typedef std::pair<Fn, void *> Entry;
+    std::vector<Entry> entries;
+
+    void add(Fn fn, void *userdata) {
+        entries.push_back(Entry(fn, userdata));
     }
 
-    void swapBack() {
-        swap(back, pending);
-        updated = true;
+    void remove(Fn fn, void *userdata) {
+        typename std::vector<Entry>::iterator it = std::find(entries.begin(), entries.end(), Entry(fn, userdata));
+        if(it != entries.end())
+            entries.erase(it);
     }
 
-    void swapFront() {
-        swap(front, pending);
-        updated = false;
+    template <typename Data> void call(const Data &data) const {
+        for(size_t i=0; i<entries.size(); i++)
+            entries[i].first(data, entries[i].second);
     }
 };
 
-struct DepthColors {
-    ofColor noConfidence;
-    ofColor colorMap[65536];
+/* A depth frame paired with the colour frame closest to it in time */
+struct FrameSet {
+    DepthFrame depth;
+    VideoFrame video;
+};
+
+/* Recent raw depth frames, for pairing with colour frames as they arrive.
+   A frame leaves the history when it is paired: take() swaps its buffer into
+   the frame set instead of copying it, so each depth frame pairs at most once. */
+#define DEPTH_HISTORY_SIZE 4
+struct DepthHistory {
+    ofShortPixels raw[DEPTH_HISTORY_SIZE];
+    ofxGestureCam::FrameInfo info[DEPTH_HISTORY_SIZE];
+    bool valid[DEPTH_HISTORY_SIZE];
+    int next;
+
+    DepthHistory() : next(0) {
+        clear();
+    }
+
+    void allocate() {
+        for(int i=0; i<DEPTH_HISTORY_SIZE; i++)
+            raw[i].allocate(ofxGestureCam::depth_width * 2, ofxGestureCam::depth_height, 1);
+    }
 
-    DepthColors() : noConfidence(0, 0, 0) {
-        for(int i=0; i<65536; i++) {
-            colorMap[i] = ofColor::fromHsb((i >> 4) & 0xff, 255, 255);
+    void clear() {
+        for(int i=0; i<DEPTH_HISTORY_SIZE; i++) {
+            raw[i].clear();
+            valid[i] = false;
         }
-        colorMap[0x7fff + 32767] = ofColor(255, 255, 255);
     }
 
-    ofColor &getColor(int16_t phase, uint16_t confidence) {
-        //if(confidence < 50)
-        //    return noConfidence;
-        return colorMap[phase + 32767];
+    void push(const DepthFrame &frame) {
+        memcpy(raw[next].getPixels(), frame.raw.getPixels(), ofxGestureCam::depth_width * ofxGestureCam::depth_height * 4);
+        info[next] = frame.info;
+        valid[next] = true;
+        next = (next + 1) % DEPTH_HISTORY_SIZE;
+    }
+
+    /* Move frame i into frame, leaving frame's old raw buffer in its place */
+    void take(int i, DepthFrame &frame) {
+        frame.raw.swap(raw[i]);
+        frame.info = info[i];
+        frame.decodedGeneration = 0;
+        valid[i] = false;
+    }
+
+    /* Index of the frame closest in time to timestamp, or -1 if none is within maxSkew microseconds */
+    int findClosest(uint64_t timestamp, int64_t maxSkew) const {
+        int best = -1;
+        int64_t bestSkew = maxSkew;
+        for(int i=0; i<DEPTH_HISTORY_SIZE; i++) {
+            if(!valid[i])
+                continue;
+            int64_t skew = (int64_t)(info[i].timestamp - timestamp);
+            if(skew < 0)
+                skew = -skew;
+            if(skew <= bestSkew) {
+                best = i;
+                bestSkew = skew;
+            }
+        }
+        return best;
     }
 };
 
@@ -117,23 +402,31 @@ class ofxGestureCamImpl {
     ofMutex mutex;
     CreativeGestureCam *cam;
 
-    static const int video_width = ofxGestureCam::video_width;
-    static const int video_height = ofxGestureCam::video_height;
     static const int depth_width = ofxGestureCam::depth_width;
     static const int depth_height = ofxGestureCam::depth_height;
 
 public:
-    ofxGestureCamImpl() : cam(NULL) {
+    ofxGestureCamImpl() : cam(NULL), videoDecodeThreads(0), videoFormatChosen(false), videoScale(1), videoLuma(false), videoDecodeOnDemand(false), compressedVideoEnabled(false),
+        videoTexDirty(false), depthDecodeInCallback(false), depthFps(60), depthOutputs(0), depthConfigGeneration(1),
+        frameSetsEnabled(false), maxFrameSetSkew(0), haveDepthListeners(false), haveVideoListeners(false),
+        haveCompressedVideoListeners(false), listenerQuit(false),
+        frameWaiters(0), depthRuns(0), videoRuns(0),
+        depthDecoder(fastAtan), frameSetSharesDepth(false) {
 #ifdef ANDROID
         /* On rooted devices, this gives us unrestricted access to USB devices.
         Note: This won't work if you plug in a USB device while the app is running.
         So, make sure you have your USB devices plugged in before the app is started. */
         system("su -c 'chmod 666 /dev/bus/usb/*/*'");
 #endif
+        videoMode.width = ofxGestureCam::video_width;
+        videoMode.height = ofxGestureCam::video_height;
+        videoMode.fps = 30;
+        videoMode.compressed = true;
     }
 
     ~ofxGestureCamImpl() {
         close();
+        stopDispatcher();
     }
 
 private:
@@ -147,6 +440,7 @@ private:
             uvc_free_device_descriptor(desc);
         }
 
+        resetStats();
         if(depthStreamEnabled)
             start_depth();
         if(videoStreamEnabled)
@@ -212,6 +506,7 @@ public:
                 cam = NULL;
                 deviceSerial = "";
             }
+            videoModes.clear();
         }
     }
 
@@ -221,24 +516,189 @@ public:
 
 private:
     void video_cb(uvc_frame_t *frame) {
+        videoCounters.receive(frame);
+
+        bool mjpeg = frame->frame_format == UVC_FRAME_FORMAT_MJPEG;
+        bool keepCompressed = mjpeg && (videoDecodeOnDemand || compressedVideoEnabled || haveCompressedVideoListeners);
+        /* Listeners and frame sets need the pixels right away */
+        bool decodeNow = !keepCompressed || haveVideoListeners || frameSetsEnabled;
+
+        if(mjpeg && videoDecodePool.isRunning()) {
+            /* Published by deliverVideo(), in order. Frames that stay compressed go through the
+               pool too, so that the back buffer never has two producers while decodeNow changes. */
+            videoCounters.overwritten += videoDecodePool.submit((const unsigned char *)frame->data,
+                frame->data_bytes, getFrameInfo(frame), decodeNow);
+            return;
+        }
+
+        VideoFrame &back = videoStreamPx.back();
+        back.info = getFrameInfo(frame);
+
+        if(keepCompressed) {
+            const unsigned char *data = (const unsigned char *)frame->data;
+            back.compressed.assign(data, data + frame->data_bytes);
+        } else {
+            back.compressed.clear();
+        }
+
+        if(decodeNow) {
+            if(!decodeVideo(frame, back.pixels.getPixels())) {
+                videoCounters.invalid++;
+                return;
+            }
+            back.decoded = true;
+            videoCounters.decoded++;
+        } else {
+            back.decoded = false;
+        }
+        publishVideo(back);
+    }
+
+    /* Called in frame order by the decode pool workers */
+    void deliverVideo(MJPEGDecodePool::Job &job) {
+        if(!job.ok) {
+            videoCounters.invalid++;
+            return;
+        }
+
+        VideoFrame &back = videoStreamPx.back();
+        back.info = job.info;
+        if(job.decode) {
+            videoCounters.decoded++;
+            back.pixels.swap(job.pixels);
+        }
+        if(!job.decode || videoDecodeOnDemand || compressedVideoEnabled || haveCompressedVideoListeners)
+            back.compressed.swap(job.compressed);
+        else
+            back.compressed.clear();
+        back.decoded = job.decode;
+        publishVideo(back);
+    }
+
+    static void static_deliver_video(void *userdata, MJPEGDecodePool::Job &job) {
+        reinterpret_cast<ofxGestureCamImpl *>(userdata)->deliverVideo(job);
+    }
+
+    /* Hand the back frame to frame sets, listeners and the app */
+    void publishVideo(VideoFrame &back) {
+        if(back.decoded && frameSetsEnabled) {
+            if(frameSetMutex.try_lock()) {
+                if(frameSetsEnabled)
+                    pairFrameSet(back);
+                frameSetMutex.unlock();
+            } else {
+                videoCounters.unpaired++;
+            }
+        }
+
+        if(haveVideoListeners || haveCompressedVideoListeners) {
+            VideoFrame &listenerBack = listenerVideoFrames.back();
+            listenerBack.info = back.info;
+            listenerBack.compressed.assign(back.compressed.begin(), back.compressed.end());
+            listenerBack.decoded = back.decoded;
+            if(back.decoded)
+                memcpy(listenerBack.pixels.getPixels(), back.pixels.getPixels(), getVideoWidth() * getVideoHeight() * getVideoChannels());
+            listenerVideoFrames.swapBack();
+            wakeDispatcher();
+        }
+
+        if(videoStreamPx.swapBack())
+            videoCounters.overwritten++;
+        wakeFrameWaiters();
+    }
+
+    /* Decode or convert the ROI of one frame into getVideoWidth() x getVideoHeight() pixels
+       of getVideoChannels() bytes each */
+    bool decodeVideo(const uvc_frame_t *frame, unsigned char *pixels) {
+        MJPEGDecoder::Output out = getVideoOutput();
+        int channels = out.getChannels();
+
+        if(frame->frame_format == UVC_FRAME_FORMAT_MJPEG) {
+            return mjpegDecoder.decode((const uint8_t *)frame->data, frame->data_bytes,
+                pixels, out.cropWidth*channels, out);
+        }
+
+        int modeWidth = videoMode.width;
+        int modeHeight = videoMode.height;
+        if((int)frame->width != modeWidth || (int)frame->height != modeHeight)
+            return false;
+
+        if(frame->frame_format == UVC_FRAME_FORMAT_YUYV || frame->frame_format == UVC_FRAME_FORMAT_UYVY) {
+            if(frame->data_bytes < (size_t)modeWidth * modeHeight * 2)
+                return false;
+            int srcStride = frame->step ? frame->step : modeWidth*2;
+            /* Top-left of the crop; crops start on a whole YUYV pixel pair */
+            const uint8_t *src = (const uint8_t *)frame->data +
+                out.cropY * videoScale * srcStride + out.cropX * videoScale * 2;
+            YUVConverter::Layout layout = (frame->frame_format == UVC_FRAME_FORMAT_YUYV) ?
+                YUVConverter::LAYOUT_YUYV : YUVConverter::LAYOUT_UYVY;
+            if(videoScale == 1) {
+                yuvConverter.convert(src, srcStride, pixels, out.cropWidth*channels, out.cropWidth, out.cropHeight,
+                    layout, videoLuma ? YUVConverter::ORDER_LUMA : YUVConverter::ORDER_RGB);
+            } else if(videoLuma) {
+                /* Luma can be picked straight out of the packed frame at any stride */
+                subsampleLuma(src + ((layout == YUVConverter::LAYOUT_YUYV) ? 0 : 1), srcStride,
+                    out.cropWidth, out.cropHeight, pixels, videoScale);
+            } else {
+                /* Only convert the rows, and the span of columns, that subsampling keeps */
+                unsigned char *row = getVideoScratch();
+                int rowWidth = (out.cropWidth - 1) * videoScale + 2;
+                for(int y=0; y<out.cropHeight; y++) {
+                    yuvConverter.convert(src + y * videoScale * srcStride, srcStride, row, rowWidth*3, rowWidth, 1,
+                        layout, YUVConverter::ORDER_RGB);
+                    subsampleRGB(row, 0, out.cropWidth, 1, pixels + y * out.cropWidth * 3, videoScale);
+                }
+            }
+            return true;
+        }
+
+        /* Other formats only convert whole frames to RGB */
+        if(videoLuma)
+            return false;
+        unsigned char *dst = getVideoScratch();
         uvc_frame_t rgb = {
-            videoStreamPx.back.getPixels(),
-            video_width*video_height*3,
-            video_width,
-            video_height,
+            dst,
+            (size_t)modeWidth*modeHeight*3,
+            (uint32_t)modeWidth,
+            (uint32_t)modeHeight,
             UVC_FRAME_FORMAT_RGB,
-            video_width*3,
+            (size_t)modeWidth*3,
             0
         };
+        if(uvc_any2rgb(const_cast<uvc_frame_t *>(frame), &rgb) != UVC_SUCCESS)
+            return false;
+        subsampleRGB(dst + (out.cropY * videoScale * modeWidth + out.cropX * videoScale) * 3, modeWidth*3,
+            out.cropWidth, out.cropHeight, pixels, videoScale);
+        return true;
+    }
 
-        if(frame->frame_format == UVC_FRAME_FORMAT_MJPEG)
-            uvc_mjpeg2rgb(frame, &rgb);
-        else
-            uvc_any2rgb(frame, &rgb);
+    /* Full-size RGB conversion target for uncompressed video */
+    unsigned char *getVideoScratch() {
+        if(!videoScratch.isAllocated())
+            videoScratch.allocate(videoMode.width, videoMode.height, 3);
+        return videoScratch.getPixels();
+    }
 
-        {
-            ofMutex::ScopedLock lock(mutex);
-            videoStreamPx.swapBack();
+    /* Nearest-neighbour pick of width x height pixels, every scale'th one, from RGB rows srcStride bytes apart */
+    static void subsampleRGB(const unsigned char *src, int srcStride, int width, int height, unsigned char *dst, int scale) {
+        for(int y=0; y<height; y++) {
+            const unsigned char *row = src + y * scale * srcStride;
+            for(int x=0; x<width; x++) {
+                const unsigned char *px = row + x * scale * 3;
+                dst[0] = px[0];
+                dst[1] = px[1];
+                dst[2] = px[2];
+                dst += 3;
+            }
+        }
+    }
+
+    /* Nearest-neighbour shrink of the Y samples of a packed 4:2:2 frame, starting at the first Y */
+    static void subsampleLuma(const unsigned char *src, int srcStride, int width, int height, unsigned char *dst, int scale) {
+        for(int y=0; y<height; y++) {
+            const unsigned char *row = src + y * scale * srcStride;
+            for(int x=0; x<width; x++)
+                *dst++ = row[x * scale * 2];
         }
     }
 
@@ -247,56 +707,242 @@ private:
     }
 
     void depth_cb(uvc_frame_t *frame) {
+        depthCounters.receive(frame);
+
         if(frame->data_bytes < depth_width * depth_height * 4) {
             LOGE("%s: invalid frame! Got size=%lu, expected %d",
                  __func__, frame->data_bytes, depth_width * depth_height * 4);
+            depthCounters.invalid++;
             return;
         }
-        memcpy(depthStreamPx.back.getPixels(), frame->data, depth_width * depth_height * 4);
-        {
-            ofMutex::ScopedLock lock(mutex);
-            depthStreamPx.swapBack();
+        DepthFrame &back = depthFrames.back();
+        memcpy(back.raw.getPixels(), frame->data, depth_width * depth_height * 4);
+        back.info = getFrameInfo(frame);
+        back.decodedGeneration = 0;
+
+        /* If the video callback is busy pairing, this frame just won't be a pairing candidate */
+        if(frameSetsEnabled) {
+            if(frameSetMutex.try_lock()) {
+                if(frameSetsEnabled)
+                    depthHistory.push(back);
+                frameSetMutex.unlock();
+            } else {
+                depthCounters.unpaired++;
+            }
+        }
+
+        /* Enabling an output reallocates the maps of every buffer. Rather than wait
+           for that, leave the frame for update() to decode. */
+        if(depthDecodeInCallback && depthConfigMutex.try_lock()) {
+            /* Never wait for update() or the dispatcher to finish with the pool */
+            if(back.decode(depthDecoder, decodePool, &depthColormap, &distanceLUT, depthConfigGeneration, false))
+                depthCounters.decoded++;
+            depthConfigMutex.unlock();
+        }
+        /* Decoded again on the dispatch thread, which is allowed to wait for configuration changes */
+        if(haveDepthListeners) {
+            DepthFrame &listenerBack = listenerDepthFrames.back();
+            memcpy(listenerBack.raw.getPixels(), back.raw.getPixels(), depth_width * depth_height * 4);
+            listenerBack.info = back.info;
+            listenerBack.decodedGeneration = 0;
+            listenerDepthFrames.swapBack();
+            wakeDispatcher();
         }
+
+        if(depthFrames.swapBack())
+            depthCounters.overwritten++;
+        wakeFrameWaiters();
     }
 
     static void static_depth_cb(uvc_frame_t *frame, void *userdata) {
         return reinterpret_cast<ofxGestureCamImpl *>(userdata)->depth_cb(frame);
     }
 
+    void wakeDispatcher() {
+        /* Taking the lock orders this wakeup after the dispatcher's check of the buffers */
+        {
+            std::lock_guard<std::mutex> lock(listenerMutex);
+        }
+        listenerCond.notify_one();
+    }
+
+    void wakeFrameWaiters() {
+        /* Pairs with the fence in waitForFrame(): either we see the waiter, or it sees the new frame */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!frameWaiters)
+            return;
+        /* As in wakeDispatcher(), order this after the waiters' check of the buffers */
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);
+        }
+        frameCond.notify_all();
+    }
+
+    /* Returns false on timeout, or if the stream is stopped (or was never started) before a frame arrives */
+    template <typename Buffer> bool waitForFrame(const Buffer &buffer, const std::atomic<unsigned> &runs, int timeoutMillis) {
+        std::unique_lock<std::mutex> lock(frameMutex);
+        frameWaiters++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned run = runs;
+        auto done = [&]{ return buffer.isUpdated() || !(run & 1) || runs != run; };
+        if(timeoutMillis < 0)
+            frameCond.wait(lock, done);
+        else
+            frameCond.wait_for(lock, std::chrono::milliseconds(timeoutMillis), done);
+        frameWaiters--;
+        return buffer.isUpdated();
+    }
+
+    /* Delivers frames to the listeners, off the USB callback threads */
+    void dispatchMain() {
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lock(listenerMutex);
+                listenerCond.wait(lock, [this]{
+                    return listenerQuit || listenerDepthFrames.isUpdated() || listenerVideoFrames.isUpdated();
+                });
+                if(listenerQuit)
+                    return;
+            }
+
+            std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+            if(listenerDepthFrames.swapFront()) {
+                DepthFrame &frame = listenerDepthFrames.front();
+                {
+                    /* Only this thread resizes the listener maps, here, so reconfiguration
+                       can't reallocate them under the listeners once the lock is released */
+                    std::lock_guard<std::mutex> configLock(depthConfigMutex);
+                    const DepthDecoder::Region &region = depthDecoder.getRegion();
+                    frame.setLayout(region.width, region.height, depthOutputs);
+                    frame.decode(depthDecoder, decodePool, &depthColormap, &distanceLUT, depthConfigGeneration);
+                }
+                depthListeners.call(frame.getData());
+            }
+            if(listenerVideoFrames.swapFront()) {
+                VideoFrame &frame = listenerVideoFrames.front();
+                if(frame.decoded)
+                    videoListeners.call(frame.getData());
+                if(!frame.compressed.empty())
+                    compressedVideoListeners.call(frame.getCompressedData());
+            }
+        }
+    }
+
+    void startDispatcher() {
+        if(!dispatchThread.joinable())
+            dispatchThread = std::thread(&ofxGestureCamImpl::dispatchMain, this);
+    }
+
+    void stopDispatcher() {
+        if(!dispatchThread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(listenerMutex);
+            listenerQuit = true;
+        }
+        listenerCond.notify_one();
+        dispatchThread.join();
+        listenerQuit = false;
+    }
+
+    /* Called from the video callback with frameSetMutex held */
+    void pairFrameSet(const VideoFrame &video) {
+        int best = depthHistory.findClosest(video.info.timestamp, maxFrameSetSkew);
+        if(best < 0) {
+            videoCounters.unpaired++;
+            return;
+        }
+
+        FrameSet &set = frameSets.back();
+        depthHistory.take(best, set.depth);
+        memcpy(set.video.pixels.getPixels(), video.pixels.getPixels(), getVideoWidth() * getVideoHeight() * getVideoChannels());
+        set.video.info = video.info;
+
+        if(depthDecodeInCallback && depthConfigMutex.try_lock()) {
+            set.depth.decode(depthDecoder, decodePool, &depthColormap, &distanceLUT, depthConfigGeneration, false);
+            depthConfigMutex.unlock();
+        }
+        frameSets.swapBack();
+    }
+
 private:
     /* These must be called with the lock held. */
-    void start_depth(int fps=60) {
-        if(cam)
-            cam->start_depth(static_depth_cb, reinterpret_cast<void *>(this), fps);
+    void start_depth() {
+        depthCounters.haveSequence = false;
+        if(cam) {
+            cam->start_depth(static_depth_cb, reinterpret_cast<void *>(this), depthFps);
+            setStreamRunning(depthRuns, true);
+        }
     }
 
-    void start_video(int width=1280, int height=720, int fps=30) {
-        if(cam)
-            cam->start_video(static_video_cb, reinterpret_cast<void *>(this), width, height, fps);
+    void start_video() {
+        videoCounters.haveSequence = false;
+        if(cam) {
+            enum uvc_frame_format format = UVC_FRAME_FORMAT_ANY;
+            if(videoFormatChosen)
+                format = videoMode.compressed ? UVC_FRAME_FORMAT_MJPEG : UVC_FRAME_FORMAT_YUYV;
+            cam->start_video(static_video_cb, reinterpret_cast<void *>(this), videoMode.width, videoMode.height,
+                videoMode.fps, format);
+            setStreamRunning(videoRuns, true);
+        }
     }
 
     void stop_depth() {
         if(cam)
             cam->stop_depth();
+        setStreamRunning(depthRuns, false);
     }
 
     void stop_video() {
         if(cam)
             cam->stop_video();
+        setStreamRunning(videoRuns, false);
+    }
+
+    /* Stopping a stream releases anyone waiting for its frames */
+    void setStreamRunning(std::atomic<unsigned> &runs, bool running) {
+        if(((runs & 1) != 0) == running)
+            return;
+        runs++;
+        if(!running)
+            wakeFrameWaiters();
     }
 
 private:
-    TripleBufferedPixels<ofPixels> videoStreamPx;
-    TripleBufferedPixels<ofShortPixels> depthStreamPx;
+    TripleBufferedPixels<VideoFrame> videoStreamPx;
+    /* Only used by the video callback */
+    MJPEGDecoder mjpegDecoder;
+    YUVConverter yuvConverter;
+    ofPixels videoScratch;
+
+    /* Decodes MJPEG off the callback thread when videoDecodeThreads > 0.
+       Only started and stopped while the video stream is stopped. */
+    MJPEGDecodePool videoDecodePool;
+    int videoDecodeThreads;
+
+    /* Camera mode and output size divisor; only changed while the video stream is stopped */
+    ofxGestureCam::VideoMode videoMode;
+    bool videoFormatChosen; /* false: take any format, as before video modes existed */
+    int videoScale;
+    ofRectangle videoROI; /* empty: the whole frame */
+    bool videoLuma; /* one byte (Y) per pixel instead of RGB */
+    vector<ofxGestureCam::VideoMode> videoModes; /* probed on first use */
+
+    /* Decode-on-demand: the callback keeps MJPEG payloads, and the app thread decodes the
+       front frame the first time its pixels or texture are wanted. */
+    std::atomic<bool> videoDecodeOnDemand;
+    /* Keep MJPEG payloads for getCompressedVideoFrame(); implies decode-on-demand */
+    std::atomic<bool> compressedVideoEnabled;
+    MJPEGDecoder frontDecoder;
+    bool videoTexDirty;
+    StreamCounters depthCounters;
+    StreamCounters videoCounters;
 
 public:
-    ofShortPixels phaseMap;
-    ofShortPixels confidenceMap;
+    /* Depth maps live in the front buffer */
+    TripleBuffered<DepthFrame> depthFrames;
+    TripleBuffered<FrameSet> frameSets;
     ofFloatPixels UVMap;
-    ofShortPixels distanceMap;
-    ofShortPixels rawIRIMap, rawIRQMap;
-    ofPixels rawIRIMap8, rawIRQMap8;
-    ofPixels depthRGBMap;
     // no videoMap: videoStream is used directly
 
     ofTexture depthTex;
@@ -318,12 +964,62 @@ private:
     Bool videoTextureEnabled;
     Bool rawIRTexturesEnabled;
 
+    std::atomic<bool> depthDecodeInCallback;
+    int depthFps;
+
+    /* Guards reallocation of the depth maps and the decoder's output selection
+       against decoding in the depth callback. */
+    std::mutex depthConfigMutex;
+    unsigned depthOutputs;
+    unsigned depthConfigGeneration;
+
+    /* Guards the depth history and the frame set buffers against the callbacks.
+       Lock after depthConfigMutex when taking both. */
+    std::mutex frameSetMutex;
+    std::atomic<bool> frameSetsEnabled;
+    int64_t maxFrameSetSkew; /* microseconds */
+    DepthHistory depthHistory;
+
+    /* Frames for the listeners, handed from the callbacks to the dispatch thread */
+    TripleBuffered<DepthFrame> listenerDepthFrames;
+    TripleBufferedPixels<VideoFrame> listenerVideoFrames;
+    ListenerList<ofxGestureCam::DepthListener> depthListeners;
+    ListenerList<ofxGestureCam::VideoListener> videoListeners;
+    ListenerList<ofxGestureCam::CompressedVideoListener> compressedVideoListeners;
+    std::atomic<bool> haveDepthListeners;
+    std::atomic<bool> haveVideoListeners;
+    std::atomic<bool> haveCompressedVideoListeners;
+
+    /* Held by the dispatch thread while it delivers frames, and to change the listeners.
+       Lock before depthConfigMutex when taking both. */
+    std::mutex dispatchMutex;
+    /* Guards listenerQuit; wakes the dispatch thread */
+    std::mutex listenerMutex;
+    std::condition_variable listenerCond;
+    bool listenerQuit;
+    std::thread dispatchThread;
+
+    /* Wakes threads blocked in waitForNextDepthFrame()/waitForNextVideoFrame() */
+    std::mutex frameMutex;
+    std::condition_variable frameCond;
+    std::atomic<int> frameWaiters;
+    /* Incremented when the stream starts and when it stops: odd while running */
+    std::atomic<unsigned> depthRuns;
+    std::atomic<unsigned> videoRuns;
+
 private:
     FastAtan2 fastAtan;
-    DepthColors depthColors;
+    DepthDecoder depthDecoder;
+    WorkerPool decodePool;
+    DepthColormap depthColormap;
+    ofxGestureCam::DistanceCalibration distanceCalibration;
+    DepthDistanceLUT distanceLUT;
 
     Bool frameNewDepth;
     Bool frameNewVideo;
+    Bool frameNewFrameSet;
+    /* The front frame set's depth is depthFrames.front(), already decoded by update() */
+    bool frameSetSharesDepth;
 
 public:
     void setEnableDepthStream(bool use) {
@@ -333,14 +1029,14 @@ public:
         if(use) {
             {
                 ofMutex::ScopedLock lock(mutex);
-                depthStreamPx.allocate(depth_width * 2, depth_height, 1);
+                setEnableDepthFrames(&DepthFrame::setEnableRaw, true);
             }
             start_depth();
         } else {
             stop_depth();
             {
                 ofMutex::ScopedLock lock(mutex);
-                depthStreamPx.clear();
+                setEnableDepthFrames(&DepthFrame::setEnableRaw, false);
             }
         }
         depthStreamEnabled = use;
@@ -353,14 +1049,20 @@ public:
         if(use) {
             {
                 ofMutex::ScopedLock lock(mutex);
-                videoStreamPx.allocate(video_width, video_height, 3);
+                videoStreamPx.allocate(getVideoWidth(), getVideoHeight(), getVideoChannels());
+                std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+                listenerVideoFrames.allocate(getVideoWidth(), getVideoHeight(), getVideoChannels());
             }
+            videoDecodePool.start(videoDecodeThreads, getVideoOutput(), static_deliver_video, this);
             start_video();
         } else {
             stop_video();
+            videoDecodePool.stop();
             {
                 ofMutex::ScopedLock lock(mutex);
                 videoStreamPx.clear();
+                std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+                listenerVideoFrames.clear();
             }
         }
         videoStreamEnabled = use;
@@ -372,11 +1074,7 @@ public:
 
         ofMutex::ScopedLock lock(mutex);
 
-        if(use) {
-            phaseMap.allocate(depth_width, depth_height, 1);
-        } else {
-            phaseMap.clear();
-        }
+        setEnableDepthOutput(DEPTH_OUTPUT_PHASE, use);
         phaseMapEnabled = use;
     }
 
@@ -386,11 +1084,7 @@ public:
 
         ofMutex::ScopedLock lock(mutex);
 
-        if(use) {
-            confidenceMap.allocate(depth_width, depth_height, 1);
-        } else {
-            confidenceMap.clear();
-        }
+        setEnableDepthOutput(DEPTH_OUTPUT_CONFIDENCE, use);
         confidenceMapEnabled = use;
     }
 
@@ -401,7 +1095,7 @@ public:
         ofMutex::ScopedLock lock(mutex);
 
         if(use) {
-            UVMap.allocate(depth_width, depth_height, 2);
+            UVMap.allocate(getDepthWidth(), getDepthHeight(), 2);
         } else {
             UVMap.clear();
         }
@@ -414,11 +1108,7 @@ public:
 
         ofMutex::ScopedLock lock(mutex);
 
-        if(use) {
-            distanceMap.allocate(depth_width, depth_height, 1);
-        } else {
-            distanceMap.clear();
-        }
+        setEnableDepthOutput(DEPTH_OUTPUT_DISTANCE, use);
         distanceMapEnabled = use;
     }
 
@@ -428,13 +1118,7 @@ public:
 
         ofMutex::ScopedLock lock(mutex);
 
-        if(use) {
-            rawIRIMap.allocate(depth_width, depth_height, 1);
-            rawIRQMap.allocate(depth_width, depth_height, 1);
-        } else {
-            rawIRIMap.clear();
-            rawIRQMap.clear();
-        }
+        setEnableDepthOutput(DEPTH_OUTPUT_RAW_IR, use);
         rawIRMapsEnabled = use;
     }
 
@@ -449,11 +1133,10 @@ public:
 
         ofMutex::ScopedLock lock(mutex);
 
+        setEnableDepthOutput(DEPTH_OUTPUT_RGB, use);
         if(use) {
-            depthRGBMap.allocate(depth_width, depth_height, 3);
-            depthTex.allocate(depth_width, depth_height, GL_RGB);
+            depthTex.allocate(getDepthWidth(), getDepthHeight(), GL_RGB);
         } else {
-            depthRGBMap.clear();
             depthTex.clear();
         }
         depthTextureEnabled = use;
@@ -466,7 +1149,7 @@ public:
         ofMutex::ScopedLock lock(mutex);
 
         if(use) {
-            videoTex.allocate(video_width, video_height, GL_RGB);
+            videoTex.allocate(getVideoWidth(), getVideoHeight(), getVideoGLFormat());
         } else {
             videoTex.clear();
         }
@@ -479,150 +1162,659 @@ public:
 
 		ofMutex::ScopedLock lock(mutex);
 
+		setEnableDepthOutput(DEPTH_OUTPUT_RAW_IR8, use);
 		if(use) {
-			rawIRIMap8.allocate(depth_width, depth_height, 1);
-			rawIRQMap8.allocate(depth_width, depth_height, 1);
-            rawIRITex.allocate(depth_width, depth_height, GL_LUMINANCE);
-            rawIRQTex.allocate(depth_width, depth_height, GL_LUMINANCE);
+            rawIRITex.allocate(getDepthWidth(), getDepthHeight(), GL_LUMINANCE);
+            rawIRQTex.allocate(getDepthWidth(), getDepthHeight(), GL_LUMINANCE);
 		} else {
-			rawIRIMap8.clear();
-			rawIRQMap8.clear();
 			rawIRITex.clear();
 			rawIRQTex.clear();
 		}
 		rawIRTexturesEnabled = use;
 	}
-public:
 
-    bool isDepthStreamNeeded() {
-        return phaseMapEnabled || confidenceMapEnabled || UVMapEnabled || distanceMapEnabled ||
-        		rawIRMapsEnabled || depthTextureEnabled || rawIRTexturesEnabled;
-    }
+    void setEnableFrameSets(bool use, float maxSkewMillis) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        std::lock_guard<std::mutex> setLock(frameSetMutex);
 
-    bool isVideoStreamNeeded() {
-        return videoMapEnabled || videoTextureEnabled;
+        maxFrameSetSkew = (int64_t)(maxSkewMillis * 1000);
+        if(use == frameSetsEnabled)
+            return;
+
+        for(int i=0; i<3; i++) {
+            FrameSet &set = frameSets.buffer(i);
+            set.depth.setMapSize(getDepthWidth(), getDepthHeight());
+            set.depth.setEnableRaw(use);
+            for(unsigned output=1; output<DEPTH_OUTPUT_COMBINATIONS; output <<= 1) {
+                if(depthOutputs & output)
+                    set.depth.setEnableOutput(output, use);
+            }
+            use ? set.video.allocate(getVideoWidth(), getVideoHeight(), getVideoChannels()) : set.video.clear();
+        }
+        frameSets.reset();
+        frameSetSharesDepth = false;
+        depthHistory.clear();
+        if(use)
+            depthHistory.allocate();
+        frameSetsEnabled = use;
     }
 
-    bool isFrameNewDepth() {
-        return frameNewDepth;
+    void setVideoDecodeOnDemand(bool use) {
+        videoDecodeOnDemand = use;
     }
 
-    bool isFrameNewVideo() {
-        return frameNewVideo;
+    void setEnableCompressedVideo(bool use) {
+        compressedVideoEnabled = use;
     }
 
-    void drawDepth(float x, float y, float w, float h) {
-        if(cam != NULL && depthStreamEnabled && depthTextureEnabled)
-            depthTex.draw(x, y, w, h);
+    ofxGestureCam::CompressedVideoFrame getCompressedVideoFrame() const {
+        return videoStreamPx.front().getCompressedData();
     }
 
-    void drawVideo(float x, float y, float w, float h) {
-        if(cam != NULL && videoStreamEnabled && videoTextureEnabled)
-            videoTex.draw(x, y, w, h);
+    /* Decoded size and crop for the current mode, scale, ROI and colour setting.
+       Scaled sizes round up, like libjpeg's. */
+    MJPEGDecoder::Output getVideoOutput() const {
+        MJPEGDecoder::Output out((videoMode.width + videoScale - 1) / videoScale,
+            (videoMode.height + videoScale - 1) / videoScale, videoScale, videoLuma);
+        if(videoROI.width > 0 && videoROI.height > 0) {
+            /* Clip to the frame, keeping YUYV pixel pairs whole. An ROI outside the frame is ignored. */
+            int x0 = std::max((int)videoROI.x, 0) & ~1;
+            int y0 = std::max((int)videoROI.y, 0);
+            int x1 = std::min(((int)(videoROI.x + videoROI.width) + 1) & ~1, videoMode.width);
+            int y1 = std::min((int)(videoROI.y + videoROI.height), videoMode.height);
+            if(x0 < x1 && y0 < y1) {
+                out.cropX = x0 / videoScale;
+                out.cropY = y0 / videoScale;
+                out.cropWidth = (x1 + videoScale - 1) / videoScale - out.cropX;
+                out.cropHeight = (y1 + videoScale - 1) / videoScale - out.cropY;
+            }
+        }
+        return out;
     }
 
-    void drawRawIRI(float x, float y, float w, float h) {
-        if(cam != NULL && depthStreamEnabled && rawIRTexturesEnabled)
-            rawIRITex.draw(x, y, w, h);
+    int getVideoWidth() const {
+        return getVideoOutput().cropWidth;
     }
 
-    void drawRawIRQ(float x, float y, float w, float h) {
-        if(cam != NULL && depthStreamEnabled && rawIRTexturesEnabled)
-            rawIRQTex.draw(x, y, w, h);
+    int getVideoHeight() const {
+        return getVideoOutput().cropHeight;
     }
 
-    void update() {
-        if(cam == NULL)
+    void setVideoROI(const ofRectangle &roi) {
+        if(roi.x == videoROI.x && roi.y == videoROI.y && roi.width == videoROI.width && roi.height == videoROI.height)
             return;
 
-        if(depthStreamPx.updated) {
-            {
-                ofMutex::ScopedLock lock(mutex);
-                depthStreamPx.swapFront();
-            }
+        /* The crop is fixed while the stream runs, even if the size stays the same */
+        bool streamEnabled = videoStreamEnabled;
+        setEnableVideoStream(false);
+        videoROI = roi;
+        reallocateVideoOutputs();
+        setEnableVideoStream(streamEnabled);
+    }
 
-            const int16_t *rawPx = (int16_t *)depthStreamPx.front.getPixels();
-
-            int16_t *phasePx = (int16_t *)phaseMap.getPixels();
-            uint16_t *confidencePx = confidenceMap.getPixels();
-            /* TODO: UV */
-            uint16_t *distancePx = distanceMap.getPixels();
-            int16_t *rawIRIPx = (int16_t *)rawIRIMap.getPixels();
-            int16_t *rawIRQPx = (int16_t *)rawIRQMap.getPixels();
-            uint8_t *rawIRI8Px = rawIRIMap8.getPixels();
-            uint8_t *rawIRQ8Px = rawIRQMap8.getPixels();
-            uint8_t *rgbPx = depthRGBMap.getPixels();
-            for(int y=0; y<240; y++) {
-                for(int x=0; x<320; x+=8) {
-                    for(int j=0; j<8; j++) {
-                        int16_t I = rawPx[640*y + 2*x + j];
-                        int16_t Q = rawPx[640*y + 2*x + 8 + j];
-                        int16_t phase = (Q == 0x7fff) ? 0x7fff : fastAtan.atan2_16(Q, I);
-                        uint16_t confidence = ((I < 0) ? -I : I) + ((Q < 0) ? -Q : Q);
-
-                        if(phaseMapEnabled)
-                            *phasePx++ = phase;
-                        if(confidenceMapEnabled)
-                            *confidencePx++ = confidence;
-                        if(distanceMapEnabled) {
-                            /* TODO: Correct the distance calculation! */
-                            *distancePx++ = (phase + 32767) / 16;
-                        }
-                        if(rawIRMapsEnabled) {
-                        	*rawIRIPx++ = I;
-                        	*rawIRQPx++ = Q;
-                        }
-                        if(depthTextureEnabled) {
-                            const ofColor &c = depthColors.getColor(phase, confidence);
-                            rgbPx[0] = c.r;
-                            rgbPx[1] = c.g;
-                            rgbPx[2] = c.b;
-                            rgbPx += 3;
-                        }
-                        if(rawIRTexturesEnabled) {
-                        	*rawIRI8Px++ = (I >> 1) + 128;
-                        	*rawIRQ8Px++ = (Q >> 1) + 128;
-                        }
-                    }
-                }
-            }
+    ofRectangle getVideoROI() const {
+        MJPEGDecoder::Output out = getVideoOutput();
+        int x = out.cropX * videoScale;
+        int y = out.cropY * videoScale;
+        return ofRectangle(x, y, std::min(out.cropWidth * videoScale, videoMode.width - x),
+            std::min(out.cropHeight * videoScale, videoMode.height - y));
+    }
 
-            if(depthTextureEnabled) {
-                depthTex.loadData(depthRGBMap.getPixels(), depth_width, depth_height, GL_RGB);
-            }
-            if(rawIRTexturesEnabled) {
-            	rawIRITex.loadData(rawIRIMap8.getPixels(), depth_width, depth_height, GL_LUMINANCE);
-            	rawIRQTex.loadData(rawIRQMap8.getPixels(), depth_width, depth_height, GL_LUMINANCE);
-            }
-            frameNewDepth = true;
-        } else {
-            frameNewDepth = false;
-        }
+    int getDepthWidth() const {
+        return depthDecoder.getRegion().width;
+    }
 
-        if(videoStreamPx.updated) {
-            {
-                ofMutex::ScopedLock lock(mutex);
-                videoStreamPx.swapFront();
-            }
+    int getDepthHeight() const {
+        return depthDecoder.getRegion().height;
+    }
 
-            if(videoTextureEnabled) {
-                videoTex.loadData(videoStreamPx.front.getPixels(), video_width, video_height, GL_RGB);
-            }
-            frameNewVideo = true;
-        } else {
-            frameNewVideo = false;
+    void setDepthROI(const ofRectangle &roi) {
+        int x = roi.x, y = roi.y, w = roi.width, h = roi.height;
+        if(w <= 0 || h <= 0) {
+            x = 0;
+            y = 0;
+            w = depth_width;
+            h = depth_height;
         }
-    }
 
-    void clear() {
         ofMutex::ScopedLock lock(mutex);
-
-        if(cam != NULL) {
-            LOGE("clear() called while camera is still active");
+        std::lock_guard<std::mutex> configLock(depthConfigMutex);
+        DepthDecoder::Region old = depthDecoder.getRegion();
+        depthDecoder.setRegion(x, y, w, h);
+        const DepthDecoder::Region &region = depthDecoder.getRegion();
+        if(region.width == 0 || region.height == 0) {
+            LOGE("Depth ROI (%d, %d, %d, %d) is outside the frame", x, y, w, h);
+            depthDecoder.setRegion(old.x, old.y, old.width, old.height);
             return;
         }
+        if(region.x == old.x && region.y == old.y && region.width == old.width && region.height == old.height)
+            return;
 
-        setEnablePhaseMap(false);
+        /* The dispatch thread resizes listenerDepthFrames itself */
+        for(int i=0; i<3; i++)
+            depthFrames.buffer(i).setMapSize(region.width, region.height);
+        {
+            std::lock_guard<std::mutex> setLock(frameSetMutex);
+            for(int i=0; i<3; i++)
+                frameSets.buffer(i).depth.setMapSize(region.width, region.height);
+        }
+        depthConfigGeneration++;
+
+        if(UVMapEnabled)
+            UVMap.allocate(region.width, region.height, 2);
+        if(depthTextureEnabled)
+            depthTex.allocate(region.width, region.height, GL_RGB);
+        if(rawIRTexturesEnabled) {
+            rawIRITex.allocate(region.width, region.height, GL_LUMINANCE);
+            rawIRQTex.allocate(region.width, region.height, GL_LUMINANCE);
+        }
+    }
+
+    ofRectangle getDepthROI() const {
+        const DepthDecoder::Region &region = depthDecoder.getRegion();
+        return ofRectangle(region.x, region.y, region.width, region.height);
+    }
+
+    const vector<ofxGestureCam::VideoMode> &listVideoModes() {
+        if(cam == NULL || !videoModes.empty())
+            return videoModes;
+
+        /* libuvc can't list format descriptors, so probe for common modes instead.
+           640x240 is left out: the depth interface answers probes for it. */
+        static const int sizes[][2] = {
+            {1280, 720}, {960, 540}, {848, 480}, {640, 480}, {640, 360},
+            {424, 240}, {320, 240}, {320, 180}, {176, 144}, {160, 120}
+        };
+        static const int rates[] = {60, 30, 25, 15};
+
+        bool streamEnabled = videoStreamEnabled;
+        if(streamEnabled)
+            stop_video();
+        for(int compressed=1; compressed>=0; compressed--) {
+            for(size_t i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+                for(size_t j=0; j<sizeof(rates)/sizeof(rates[0]); j++) {
+                    ofxGestureCam::VideoMode mode;
+                    mode.width = sizes[i][0];
+                    mode.height = sizes[i][1];
+                    mode.fps = rates[j];
+                    mode.compressed = compressed;
+                    if(cam->probe_video_mode(compressed ? UVC_FRAME_FORMAT_MJPEG : UVC_FRAME_FORMAT_YUYV,
+                            mode.width, mode.height, mode.fps))
+                        videoModes.push_back(mode);
+                }
+            }
+        }
+        if(streamEnabled)
+            start_video();
+        return videoModes;
+    }
+
+    ofxGestureCam::VideoMode getVideoMode() const {
+        return videoMode;
+    }
+
+    bool setVideoMode(const ofxGestureCam::VideoMode &mode) {
+        if(mode.width == videoMode.width && mode.height == videoMode.height &&
+                mode.fps == videoMode.fps && mode.compressed == videoMode.compressed && videoFormatChosen)
+            return true;
+        if(mode.width <= 0 || mode.height <= 0 || (mode.width & 1)) {
+            LOGE("Invalid video mode %dx%d", mode.width, mode.height);
+            return false;
+        }
+        if(cam) {
+            const vector<ofxGestureCam::VideoMode> &modes = listVideoModes();
+            bool found = false;
+            for(size_t i=0; i<modes.size(); i++) {
+                if(modes[i].width == mode.width && modes[i].height == mode.height &&
+                        modes[i].fps == mode.fps && modes[i].compressed == mode.compressed)
+                    found = true;
+            }
+            if(!found) {
+                LOGE("Video mode %dx%d@%d %s is not supported by the device",
+                    mode.width, mode.height, mode.fps, mode.compressed ? "MJPEG" : "YUYV");
+                return false;
+            }
+        }
+
+        if(mode.width == videoMode.width && mode.height == videoMode.height) {
+            /* Same buffers; just renegotiate the stream */
+            bool streamEnabled = videoStreamEnabled;
+            if(streamEnabled)
+                stop_video();
+            videoMode = mode;
+            videoFormatChosen = true;
+            if(streamEnabled)
+                start_video();
+        } else {
+            bool streamEnabled = videoStreamEnabled;
+            setEnableVideoStream(false);
+            videoMode = mode;
+            videoFormatChosen = true;
+            reallocateVideoOutputs();
+            setEnableVideoStream(streamEnabled);
+        }
+        return true;
+    }
+
+    /* Resize the frame sets and texture after a change to getVideoWidth()/getVideoHeight().
+       The video stream must be disabled; it reallocates its own buffers when enabled. */
+    void reallocateVideoOutputs() {
+        videoScratch.clear();
+        {
+            std::lock_guard<std::mutex> setLock(frameSetMutex);
+            if(frameSetsEnabled) {
+                for(int i=0; i<3; i++)
+                    frameSets.buffer(i).video.allocate(getVideoWidth(), getVideoHeight(), getVideoChannels());
+                frameSets.reset();
+            }
+        }
+        if(videoTextureEnabled) {
+            ofMutex::ScopedLock lock(mutex);
+            videoTex.allocate(getVideoWidth(), getVideoHeight(), getVideoGLFormat());
+        }
+    }
+
+    int getVideoChannels() const {
+        return videoLuma ? 1 : 3;
+    }
+
+    int getVideoGLFormat() const {
+        return videoLuma ? GL_LUMINANCE : GL_RGB;
+    }
+
+    void setVideoGrayscale(bool luma) {
+        if(luma == videoLuma)
+            return;
+
+        bool streamEnabled = videoStreamEnabled;
+        setEnableVideoStream(false);
+        videoLuma = luma;
+        reallocateVideoOutputs();
+        setEnableVideoStream(streamEnabled);
+    }
+
+    bool isVideoGrayscale() const {
+        return videoLuma;
+    }
+
+    void setVideoScale(int scale) {
+        if(scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+            LOGE("Unsupported video scale 1/%d (must be 1/1, 1/2, 1/4 or 1/8)", scale);
+            return;
+        }
+        if(scale == videoScale)
+            return;
+
+        /* Reallocate everything sized by the video output with the stream stopped */
+        bool streamEnabled = videoStreamEnabled;
+        setEnableVideoStream(false);
+        videoScale = scale;
+        reallocateVideoOutputs();
+        setEnableVideoStream(streamEnabled);
+    }
+
+    void setVideoDecodeThreads(int numThreads) {
+        if(numThreads < 0)
+            numThreads = 0;
+        if(numThreads == videoDecodeThreads)
+            return;
+
+        bool streamEnabled = videoStreamEnabled;
+        setEnableVideoStream(false);
+        videoDecodeThreads = numThreads;
+        setEnableVideoStream(streamEnabled);
+    }
+
+    void setDepthDecodeInCallback(bool use) {
+        depthDecodeInCallback = use;
+    }
+
+    ofxGestureCam::StreamStats getDepthStats() const {
+        return depthCounters.get();
+    }
+
+    ofxGestureCam::StreamStats getVideoStats() const {
+        return videoCounters.get();
+    }
+
+    void resetStats() {
+        depthCounters.reset();
+        videoCounters.reset();
+    }
+
+    void setDepthFrameRate(int fps) {
+        if(fps != 30 && fps != 60) {
+            LOGE("Unsupported depth frame rate %d (must be 30 or 60)", fps);
+            return;
+        }
+        if(fps == depthFps)
+            return;
+
+        if(depthStreamEnabled && cam) {
+            uvc_error_t res = cam->set_depth_fps(fps);
+            if(res != UVC_SUCCESS) {
+                LOGE("Can't set depth frame rate %d: %s", fps, uvc_strerror(res));
+                return;
+            }
+        }
+        depthFps = fps;
+    }
+
+    int getDepthFrameRate() const {
+        return depthFps;
+    }
+
+    void setConfidenceMode(ofxGestureCam::ConfidenceMode mode, int cordicIterations) {
+        DepthDecoder::ConfidenceMode decoderMode = (mode == ofxGestureCam::CONFIDENCE_AMPLITUDE) ?
+            DepthDecoder::CONFIDENCE_AMPLITUDE : DepthDecoder::CONFIDENCE_L1;
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthDecoder.setConfidenceMode(decoderMode, cordicIterations);
+        depthConfigGeneration++;
+    }
+
+    ofxGestureCam::ConfidenceMode getConfidenceMode() const {
+        return (depthDecoder.getConfidenceMode() == DepthDecoder::CONFIDENCE_AMPLITUDE) ?
+            ofxGestureCam::CONFIDENCE_AMPLITUDE : ofxGestureCam::CONFIDENCE_L1;
+    }
+
+    /* Colour map changes recolour frames that were already decoded */
+    void setDepthColormap(ofxGestureCam::DepthColormapType map, int size) {
+        DepthColormap::Builtin builtin = DepthColormap::HSB;
+        switch(map) {
+            case ofxGestureCam::COLORMAP_HSB: builtin = DepthColormap::HSB; break;
+            case ofxGestureCam::COLORMAP_TURBO: builtin = DepthColormap::TURBO; break;
+            case ofxGestureCam::COLORMAP_GRAYSCALE: builtin = DepthColormap::GRAYSCALE; break;
+            case ofxGestureCam::COLORMAP_JET: builtin = DepthColormap::JET; break;
+        }
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthColormap.setBuiltin(builtin, size);
+        depthConfigGeneration++;
+    }
+
+    void setDepthColormap(const vector<ofColor> &colors, int size) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthColormap.setColors(colors, size);
+        depthConfigGeneration++;
+    }
+
+    void setDepthColorRange(int nearPhase, int farPhase, bool wrap) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthColormap.setRange(nearPhase, farPhase, wrap);
+        depthConfigGeneration++;
+    }
+
+    void setDepthColorMask(unsigned short minConfidence, bool maskOutOfRange) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthColormap.setMask(minConfidence, maskOutOfRange);
+        depthConfigGeneration++;
+    }
+
+    void setDepthInvalidColor(const ofColor &color) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        depthColormap.setInvalidColor(color);
+        depthConfigGeneration++;
+    }
+
+    void setDistanceCalibration(const ofxGestureCam::DistanceCalibration &calibration) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        distanceCalibration = calibration;
+        distanceLUT.build(calibration);
+        depthConfigGeneration++;
+    }
+
+    const ofxGestureCam::DistanceCalibration &getDistanceCalibration() const {
+        return distanceCalibration;
+    }
+
+    bool loadDistanceCalibration(const string &path) {
+        ofxGestureCam::DistanceCalibration calibration = distanceCalibration;
+        if(!DepthDistanceLUT::load(path.c_str(), calibration))
+            return false;
+        setDistanceCalibration(calibration);
+        return true;
+    }
+
+    bool readCalibrationROM(unsigned char *buf, int address, int length) {
+        if(cam == NULL || address < 0 || length < 0 || address + length > 0x10000)
+            return false;
+        return cam->read_rom(buf, address, length) == UVC_SUCCESS;
+    }
+
+    void setDepthDecodeThreads(int numThreads) {
+        /* Waits for any decode in progress */
+        decodePool.setNumThreads(numThreads);
+    }
+
+private:
+    /* The depth stream must be stopped. */
+    void setEnableDepthFrames(void (DepthFrame::*setEnable)(bool), bool use) {
+        for(int i=0; i<3; i++)
+            (depthFrames.buffer(i).*setEnable)(use);
+        depthFrames.reset();
+
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        for(int i=0; i<3; i++)
+            (listenerDepthFrames.buffer(i).*setEnable)(use);
+        listenerDepthFrames.reset();
+    }
+
+    /* Allocate or free one output in every buffer, and select the matching decoder. */
+    void setEnableDepthOutput(unsigned output, bool use) {
+        std::lock_guard<std::mutex> lock(depthConfigMutex);
+        /* The dispatch thread updates listenerDepthFrames itself */
+        for(int i=0; i<3; i++)
+            depthFrames.buffer(i).setEnableOutput(output, use);
+        {
+            std::lock_guard<std::mutex> setLock(frameSetMutex);
+            if(frameSetsEnabled) {
+                for(int i=0; i<3; i++)
+                    frameSets.buffer(i).depth.setEnableOutput(output, use);
+            }
+        }
+        if(use)
+            depthOutputs |= output;
+        else
+            depthOutputs &= ~output;
+        depthDecoder.setOutputs(depthOutputs);
+        depthConfigGeneration++;
+    }
+
+public:
+    bool isDepthStreamNeeded() {
+        return phaseMapEnabled || confidenceMapEnabled || UVMapEnabled || distanceMapEnabled ||
+        		rawIRMapsEnabled || depthTextureEnabled || rawIRTexturesEnabled || frameSetsEnabled ||
+        		haveDepthListeners;
+    }
+
+    bool isVideoStreamNeeded() {
+        return videoMapEnabled || videoTextureEnabled || frameSetsEnabled || haveVideoListeners ||
+            compressedVideoEnabled || haveCompressedVideoListeners;
+    }
+
+    bool isFrameNewDepth() {
+        return frameNewDepth;
+    }
+
+    bool isFrameNewVideo() {
+        return frameNewVideo;
+    }
+
+    bool isFrameSetNew() {
+        return frameNewFrameSet;
+    }
+
+    ofxGestureCam::FrameInfo getDepthFrameInfo() const {
+        return depthFrames.front().info;
+    }
+
+    ofxGestureCam::FrameInfo getVideoFrameInfo() const {
+        return videoStreamPx.front().info;
+    }
+
+    ofxGestureCam::FrameSet getFrameSet() {
+        FrameSet &set = frameSets.front();
+        ofxGestureCam::FrameSet ret;
+        ret.depth = frameSetSharesDepth ? depthFrames.front().getData() : set.depth.getData();
+        ret.video = set.video.getData();
+        return ret;
+    }
+
+    bool waitForNextDepthFrame(int timeoutMillis) {
+        return waitForFrame(depthFrames, depthRuns, timeoutMillis);
+    }
+
+    bool waitForNextVideoFrame(int timeoutMillis) {
+        return waitForFrame(videoStreamPx, videoRuns, timeoutMillis);
+    }
+
+    void addDepthListener(ofxGestureCam::DepthListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        depthListeners.add(fn, userdata);
+        haveDepthListeners = true;
+        startDispatcher();
+    }
+
+    void removeDepthListener(ofxGestureCam::DepthListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        depthListeners.remove(fn, userdata);
+        haveDepthListeners = !depthListeners.entries.empty();
+    }
+
+    void addVideoListener(ofxGestureCam::VideoListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        videoListeners.add(fn, userdata);
+        haveVideoListeners = true;
+        startDispatcher();
+    }
+
+    void removeVideoListener(ofxGestureCam::VideoListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        videoListeners.remove(fn, userdata);
+        haveVideoListeners = !videoListeners.entries.empty();
+    }
+
+    void addCompressedVideoListener(ofxGestureCam::CompressedVideoListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        compressedVideoListeners.add(fn, userdata);
+        haveCompressedVideoListeners = true;
+        startDispatcher();
+    }
+
+    void removeCompressedVideoListener(ofxGestureCam::CompressedVideoListener fn, void *userdata) {
+        std::lock_guard<std::mutex> dispatchLock(dispatchMutex);
+        compressedVideoListeners.remove(fn, userdata);
+        haveCompressedVideoListeners = !compressedVideoListeners.entries.empty();
+    }
+
+    void drawDepth(float x, float y, float w, float h) {
+        if(cam != NULL && depthStreamEnabled && depthTextureEnabled)
+            depthTex.draw(x, y, w, h);
+    }
+
+    void drawVideo(float x, float y, float w, float h) {
+        if(cam != NULL && videoStreamEnabled && videoTextureEnabled) {
+            updateVideoTexture();
+            videoTex.draw(x, y, w, h);
+        }
+    }
+
+    /* Decodes the front frame if the callback left it compressed */
+    VideoFrame &getVideoFront() {
+        VideoFrame &frame = videoStreamPx.front();
+        if(!frame.decoded) {
+            MJPEGDecoder::Output out = getVideoOutput();
+            if(frontDecoder.decode(frame.compressed.data(), frame.compressed.size(),
+                    frame.pixels.getPixels(), out.cropWidth * out.getChannels(), out))
+                videoCounters.decoded++;
+            else
+                videoCounters.invalid++;
+            frame.decoded = true;
+        }
+        return frame;
+    }
+
+    void updateVideoTexture() {
+        if(!videoTexDirty)
+            return;
+        videoTexDirty = false;
+        videoTex.loadData(getVideoFront().pixels.getPixels(), getVideoWidth(), getVideoHeight(), getVideoGLFormat());
+    }
+
+    unsigned char *getVideoPixels() {
+        return getVideoFront().pixels.getPixels();
+    }
+
+    ofTexture &getVideoTextureRef() {
+        updateVideoTexture();
+        return videoTex;
+    }
+
+    void drawRawIRI(float x, float y, float w, float h) {
+        if(cam != NULL && depthStreamEnabled && rawIRTexturesEnabled)
+            rawIRITex.draw(x, y, w, h);
+    }
+
+    void drawRawIRQ(float x, float y, float w, float h) {
+        if(cam != NULL && depthStreamEnabled && rawIRTexturesEnabled)
+            rawIRQTex.draw(x, y, w, h);
+    }
+
+    void update() {
+        if(cam == NULL)
+            return;
+
+        if(depthFrames.swapFront()) {
+            /* No-op if the frame was already decoded in the callback */
+            DepthFrame &frame = depthFrames.front();
+            if(frame.decode(depthDecoder, decodePool, &depthColormap, &distanceLUT, depthConfigGeneration))
+                depthCounters.decoded++;
+            depthCounters.consumed++;
+
+            if(depthTextureEnabled) {
+                depthTex.loadData(frame.depthRGBMap.getPixels(), getDepthWidth(), getDepthHeight(), GL_RGB);
+            }
+            if(rawIRTexturesEnabled) {
+            	rawIRITex.loadData(frame.rawIRIMap8.getPixels(), getDepthWidth(), getDepthHeight(), GL_LUMINANCE);
+            	rawIRQTex.loadData(frame.rawIRQMap8.getPixels(), getDepthWidth(), getDepthHeight(), GL_LUMINANCE);
+            }
+            frameNewDepth = true;
+        } else {
+            frameNewDepth = false;
+        }
+
+        if(videoStreamPx.swapFront()) {
+            videoCounters.consumed++;
+            videoTexDirty = videoTextureEnabled;
+            if(videoStreamPx.front().decoded)
+                updateVideoTexture();
+            frameNewVideo = true;
+        } else {
+            frameNewVideo = false;
+        }
+
+        frameNewFrameSet = frameSets.swapFront();
+        if(frameNewFrameSet || frameSetSharesDepth) {
+            /* The set's depth frame is usually the one just decoded above: share its maps
+               rather than decode it twice, until depthFrames moves on to a newer frame.
+               Maps are only reallocated by this thread, so no lock is needed. */
+            FrameSet &set = frameSets.front();
+            const DepthFrame &depth = depthFrames.front();
+            frameSetSharesDepth = depth.info.sequence == set.depth.info.sequence &&
+                depth.info.timestamp == set.depth.info.timestamp && depth.decodedGeneration == depthConfigGeneration;
+            if(!frameSetSharesDepth)
+                set.depth.decode(depthDecoder, decodePool, &depthColormap, &distanceLUT, depthConfigGeneration);
+        }
+    }
+
+    void clear() {
+        ofMutex::ScopedLock lock(mutex);
+
+        if(cam != NULL) {
+            LOGE("clear() called while camera is still active");
+            return;
+        }
+
+        setEnablePhaseMap(false);
         setEnableConfidenceMap(false);
         setEnableUVMap(false);
         setEnableDistanceMap(false);
@@ -811,6 +2003,167 @@ void ofxGestureCam::disableVideoTexture() {
 }
 
 
+void ofxGestureCam::enableCompressedVideo() {
+    impl->setEnableCompressedVideo(true);
+    impl->setEnableVideoStream(true);
+}
+
+void ofxGestureCam::disableCompressedVideo() {
+    impl->setEnableCompressedVideo(false);
+    if(!impl->isVideoStreamNeeded())
+        impl->setEnableVideoStream(false);
+}
+
+ofxGestureCam::CompressedVideoFrame ofxGestureCam::getCompressedVideoFrame() const {
+    return impl->getCompressedVideoFrame();
+}
+
+void ofxGestureCam::setVideoDecodeOnDemand(bool enable) {
+    impl->setVideoDecodeOnDemand(enable);
+}
+
+void ofxGestureCam::setVideoScale(int scale) {
+    impl->setVideoScale(scale);
+}
+
+int ofxGestureCam::getVideoWidth() const {
+    return impl->getVideoWidth();
+}
+
+int ofxGestureCam::getVideoHeight() const {
+    return impl->getVideoHeight();
+}
+
+void ofxGestureCam::setVideoGrayscale(bool grayscale) {
+    impl->setVideoGrayscale(grayscale);
+}
+
+bool ofxGestureCam::isVideoGrayscale() const {
+    return impl->isVideoGrayscale();
+}
+
+int ofxGestureCam::getVideoChannels() const {
+    return impl->getVideoChannels();
+}
+
+void ofxGestureCam::setVideoROI(const ofRectangle &roi) {
+    impl->setVideoROI(roi);
+}
+
+ofRectangle ofxGestureCam::getVideoROI() const {
+    return impl->getVideoROI();
+}
+
+void ofxGestureCam::setDepthROI(const ofRectangle &roi) {
+    impl->setDepthROI(roi);
+}
+
+ofRectangle ofxGestureCam::getDepthROI() const {
+    return impl->getDepthROI();
+}
+
+int ofxGestureCam::getDepthWidth() const {
+    return impl->getDepthWidth();
+}
+
+int ofxGestureCam::getDepthHeight() const {
+    return impl->getDepthHeight();
+}
+
+vector<ofxGestureCam::VideoMode> ofxGestureCam::listVideoModes() {
+    return impl->listVideoModes();
+}
+
+bool ofxGestureCam::setVideoMode(const VideoMode &mode) {
+    return impl->setVideoMode(mode);
+}
+
+ofxGestureCam::VideoMode ofxGestureCam::getVideoMode() const {
+    return impl->getVideoMode();
+}
+
+
+void ofxGestureCam::setDepthDecodeInCallback(bool enable) {
+    impl->setDepthDecodeInCallback(enable);
+}
+
+
+void ofxGestureCam::setVideoDecodeThreads(int numThreads) {
+    impl->setVideoDecodeThreads(numThreads);
+}
+
+void ofxGestureCam::setDepthDecodeThreads(int numThreads) {
+    impl->setDepthDecodeThreads(numThreads);
+}
+
+void ofxGestureCam::setDepthFrameRate(int fps) {
+    impl->setDepthFrameRate(fps);
+}
+
+int ofxGestureCam::getDepthFrameRate() const {
+    return impl->getDepthFrameRate();
+}
+
+void ofxGestureCam::setConfidenceMode(ConfidenceMode mode, int cordicIterations) {
+    impl->setConfidenceMode(mode, cordicIterations);
+}
+
+ofxGestureCam::ConfidenceMode ofxGestureCam::getConfidenceMode() const {
+    return impl->getConfidenceMode();
+}
+
+void ofxGestureCam::setDepthColormap(DepthColormapType map, int size) {
+    impl->setDepthColormap(map, size);
+}
+
+void ofxGestureCam::setDepthColormap(const vector<ofColor> &colors, int size) {
+    impl->setDepthColormap(colors, size);
+}
+
+void ofxGestureCam::setDepthColorRange(int nearPhase, int farPhase, bool wrap) {
+    impl->setDepthColorRange(nearPhase, farPhase, wrap);
+}
+
+void ofxGestureCam::setDepthColorMask(unsigned short minConfidence, bool maskOutOfRange) {
+    impl->setDepthColorMask(minConfidence, maskOutOfRange);
+}
+
+void ofxGestureCam::setDepthInvalidColor(const ofColor &color) {
+    impl->setDepthInvalidColor(color);
+}
+
+void ofxGestureCam::setDistanceCalibration(const DistanceCalibration &calibration) {
+    impl->setDistanceCalibration(calibration);
+}
+
+const ofxGestureCam::DistanceCalibration &ofxGestureCam::getDistanceCalibration() const {
+    return impl->getDistanceCalibration();
+}
+
+bool ofxGestureCam::loadDistanceCalibration(const string &path) {
+    return impl->loadDistanceCalibration(path);
+}
+
+bool ofxGestureCam::readCalibrationROM(unsigned char *buf, int address, int length) {
+    return impl->readCalibrationROM(buf, address, length);
+}
+
+
+void ofxGestureCam::enableFrameSets(float maxSkewMillis) {
+    impl->setEnableDepthStream(true);
+    impl->setEnableVideoStream(true);
+    impl->setEnableFrameSets(true, maxSkewMillis);
+}
+
+void ofxGestureCam::disableFrameSets() {
+    impl->setEnableFrameSets(false, 0);
+    if(!impl->isDepthStreamNeeded())
+        impl->setEnableDepthStream(false);
+    if(!impl->isVideoStreamNeeded())
+        impl->setEnableVideoStream(false);
+}
+
+
 bool ofxGestureCam::isFrameNewVideo() {
     return impl->isFrameNewVideo();
 }
@@ -819,6 +2172,18 @@ bool ofxGestureCam::isFrameNewDepth() {
     return impl->isFrameNewDepth();
 }
 
+bool ofxGestureCam::waitForNextDepthFrame(int timeoutMillis) {
+    return impl->waitForNextDepthFrame(timeoutMillis);
+}
+
+bool ofxGestureCam::waitForNextVideoFrame(int timeoutMillis) {
+    return impl->waitForNextVideoFrame(timeoutMillis);
+}
+
+bool ofxGestureCam::isFrameSetNew() {
+    return impl->isFrameSetNew();
+}
+
 
 void ofxGestureCam::close() {
     impl->close();
@@ -849,11 +2214,11 @@ void ofxGestureCam::drawRawIRQ(float x, float y, float w, float h) {
 }
 
 short* ofxGestureCam::getPhasePixels() {
-    return reinterpret_cast<short *>(impl->phaseMap.getPixels());
+    return reinterpret_cast<short *>(impl->depthFrames.front().phaseMap.getPixels());
 }
 
 unsigned short* ofxGestureCam::getConfidencePixels() {
-    return impl->confidenceMap.getPixels();
+    return impl->depthFrames.front().confidenceMap.getPixels();
 }
 
 ofVec2f* ofxGestureCam::getUVCoords() {
@@ -861,19 +2226,23 @@ ofVec2f* ofxGestureCam::getUVCoords() {
 }
 
 unsigned short* ofxGestureCam::getDistancePixels() {
-    return impl->distanceMap.getPixels();
+    return impl->depthFrames.front().distanceMap.getPixels();
 }
 
 short* ofxGestureCam::getRawIRIPixels() {
-	return reinterpret_cast<short *>(impl->rawIRIMap.getPixels());
+	return reinterpret_cast<short *>(impl->depthFrames.front().rawIRIMap.getPixels());
 }
 
 short* ofxGestureCam::getRawIRQPixels() {
-	return reinterpret_cast<short *>(impl->rawIRQMap.getPixels());
+	return reinterpret_cast<short *>(impl->depthFrames.front().rawIRQMap.getPixels());
+}
+
+unsigned char* ofxGestureCam::getVideoPixels() {
+    return impl->getVideoPixels();
 }
 
 ofTexture& ofxGestureCam::getVideoTextureRef() {
-    return impl->videoTex;
+    return impl->getVideoTextureRef();
 }
 
 ofTexture& ofxGestureCam::getDepthTextureRef() {
@@ -888,6 +2257,63 @@ ofTexture& ofxGestureCam::getRawIRQTextureRef() {
     return impl->rawIRQTex;
 }
 
+ofxGestureCam::StreamStats ofxGestureCam::getDepthStats() const {
+    return impl->getDepthStats();
+}
+
+ofxGestureCam::StreamStats ofxGestureCam::getVideoStats() const {
+    return impl->getVideoStats();
+}
+
+void ofxGestureCam::resetStats() {
+    impl->resetStats();
+}
+
+ofxGestureCam::FrameSet ofxGestureCam::getFrameSet() {
+    return impl->getFrameSet();
+}
+
+ofxGestureCam::FrameInfo ofxGestureCam::getDepthFrameInfo() const {
+    return impl->getDepthFrameInfo();
+}
+
+ofxGestureCam::FrameInfo ofxGestureCam::getVideoFrameInfo() const {
+    return impl->getVideoFrameInfo();
+}
+
+void ofxGestureCam::addDepthListener(DepthListener listener, void *userdata) {
+    impl->addDepthListener(listener, userdata);
+    impl->setEnableDepthStream(true);
+}
+
+void ofxGestureCam::removeDepthListener(DepthListener listener, void *userdata) {
+    impl->removeDepthListener(listener, userdata);
+    if(!impl->isDepthStreamNeeded())
+        impl->setEnableDepthStream(false);
+}
+
+void ofxGestureCam::addVideoListener(VideoListener listener, void *userdata) {
+    impl->addVideoListener(listener, userdata);
+    impl->setEnableVideoStream(true);
+}
+
+void ofxGestureCam::removeVideoListener(VideoListener listener, void *userdata) {
+    impl->removeVideoListener(listener, userdata);
+    if(!impl->isVideoStreamNeeded())
+        impl->setEnableVideoStream(false);
+}
+
+void ofxGestureCam::addCompressedVideoListener(CompressedVideoListener listener, void *userdata) {
+    impl->addCompressedVideoListener(listener, userdata);
+    impl->setEnableVideoStream(true);
+}
+
+void ofxGestureCam::removeCompressedVideoListener(CompressedVideoListener listener, void *userdata) {
+    impl->removeCompressedVideoListener(listener, userdata);
+    if(!impl->isVideoStreamNeeded())
+        impl->setEnableVideoStream(false);
+}
+
 string ofxGestureCam::getSerial() const {
     return impl->deviceSerial;
 }
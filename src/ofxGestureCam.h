@@ -104,6 +104,179 @@ public:
     void enableRawIRTextures();
     void disableRawIRTextures();
 
+    /// Shrink the video output by 1, 2, 4 or 8 in each dimension (default: 1).
+    /// MJPEG frames are scaled during decoding, which is much cheaper than a
+    /// full-size decode. The video pixels and texture are
+    /// getVideoWidth() x getVideoHeight(), i.e. the video mode's size divided
+    /// by the scale and rounded up.
+    void setVideoScale(int scale);
+    int getVideoWidth() const;
+    int getVideoHeight() const;
+
+    /// Grayscale video (default: off): the video pixels, listeners and frame sets
+    /// get one luma byte per pixel and the texture is GL_LUMINANCE. MJPEG frames
+    /// skip chroma decoding and YUYV frames skip colour conversion.
+    /// Changing this restarts the video stream.
+    void setVideoGrayscale(bool grayscale=true);
+    bool isVideoGrayscale() const;
+    /// Bytes per video pixel: 3 (RGB), or 1 when grayscale
+    int getVideoChannels() const;
+
+    /// Regions of interest. Only this rectangle of each frame is decoded, and
+    /// the maps, pixels and textures shrink to it. An empty rectangle (the
+    /// default) means the whole frame; get*ROI() return the rectangle in use.
+    /// The depth ROI is in depth pixels, widened to multiples of 8 columns; its
+    /// maps are getDepthWidth() x getDepthHeight().
+    void setDepthROI(const ofRectangle &roi);
+    ofRectangle getDepthROI() const;
+    int getDepthWidth() const;
+    int getDepthHeight() const;
+    /// The video ROI is in pixels of the video mode, before setVideoScale(), and
+    /// starts and ends on even columns. Changing it restarts the video stream.
+    void setVideoROI(const ofRectangle &roi);
+    ofRectangle getVideoROI() const;
+
+    /// Camera video mode (default: video_width x video_height at 30 fps, in
+    /// whichever format the camera offers first; getVideoMode() reports it as
+    /// MJPEG until setVideoMode() picks a format).
+    struct VideoMode {
+        int width, height, fps;
+        bool compressed; ///< MJPEG if true, YUYV otherwise
+    };
+    /// Modes the camera supports. The first call probes the device for each
+    /// common size and rate, briefly stopping the video stream if it is running.
+    vector<VideoMode> listVideoModes();
+    /// Switch to one of the listed modes. Only the video stream is restarted,
+    /// and video buffers are only reallocated if the size changes.
+    /// Returns false if the camera doesn't support the mode.
+    bool setVideoMode(const VideoMode &mode);
+    VideoMode getVideoMode() const;
+
+    /// Compressed video (the camera's own MJPEG frames, see getCompressedVideoFrame()).
+    /// While enabled, decoding of RGB video is deferred as with setVideoDecodeOnDemand(),
+    /// so if nothing uses the video pixels or texture, frames are never decoded.
+    /// Enabling this will enable the video stream.
+    void setEnableCompressedVideo(bool enable=true) { enable ? enableCompressedVideo() : disableCompressedVideo(); }
+    void enableCompressedVideo();
+    void disableCompressedVideo();
+
+    /// Defer MJPEG decoding until the video pixels or texture are used (default: off).
+    /// The USB callback only keeps the compressed frame, and the first call to
+    /// getVideoPixels(), getVideoTextureRef() or drawVideo() after update()
+    /// decodes it. Frames replaced before anyone looks at them are never decoded.
+    /// Frames are still decoded on arrival while video listeners or frame sets are active.
+    void setVideoDecodeOnDemand(bool enable=true);
+
+    /// Decode depth frames on the USB callback thread as they arrive (default: off).
+    /// When off, depth frames are decoded in update(). When on, update() only
+    /// swaps in the newest decoded frame and uploads the enabled textures, so
+    /// decoding overlaps with rendering.
+    void setDepthDecodeInCallback(bool enable=true);
+
+    /// Synchronized depth+colour frame sets (see getFrameSet()).
+    /// Each colour frame is paired with the recent depth frame closest to it in
+    /// capture time, if they are at most maxSkewMillis apart; each depth frame
+    /// joins at most one set. Pairing is done on the USB callback threads as
+    /// colour frames arrive, and a set's depth maps are shared with the depth
+    /// frame taken by the same update() when they are the same frame.
+    /// Enabling this will enable the depth and video streams.
+    void enableFrameSets(float maxSkewMillis=10);
+    void disableFrameSets();
+
+    /// Number of extra threads used to decode each depth frame (default: 0).
+    /// Rows are split into bands shared between these threads and the thread
+    /// doing the decode. The threads persist until the count changes.
+    void setDepthDecodeThreads(int numThreads);
+
+    /// Depth frame rate, 30 or 60 fps (default: 60). A running depth stream
+    /// switches rate in place, without being restarted. 30 fps halves the
+    /// depth stream's USB traffic and decoding work.
+    void setDepthFrameRate(int fps);
+    int getDepthFrameRate() const;
+
+    /// How the confidence map measures signal strength.
+    enum ConfidenceMode {
+        /// |I| + |Q| (default): nearly free, but up to 41% high along the I/Q diagonals
+        CONFIDENCE_L1,
+        /// sqrt(I^2 + Q^2), the true amplitude, by fixed-point CORDIC
+        CONFIDENCE_AMPLITUDE
+    };
+    /// Select the confidence measure. cordicIterations (1 to 24) trades
+    /// accuracy for speed in CONFIDENCE_AMPLITUDE mode; 16 keeps the amplitude
+    /// within 1 and costs well under a millisecond per frame with SIMD.
+    void setConfidenceMode(ConfidenceMode mode, int cordicIterations=16);
+    ConfidenceMode getConfidenceMode() const;
+
+    /// Built-in colour maps for the depth texture.
+    enum DepthColormapType {
+        /// Hue circle (default, repeating every 4096 phase units)
+        COLORMAP_HSB,
+        COLORMAP_TURBO,
+        COLORMAP_GRAYSCALE,
+        COLORMAP_JET
+    };
+    /// Colour the depth texture with a built-in map of size entries (a power
+    /// of two up to 4096; 256 is plenty for 8-bit output).
+    void setDepthColormap(DepthColormapType map, int size=256);
+    /// Colour the depth texture with colors, resampled to size entries.
+    void setDepthColormap(const vector<ofColor> &colors, int size=256);
+    /// Phase range spread over the colour map. farPhase may be below nearPhase
+    /// to reverse the map. Phases outside the range take the end colours, or
+    /// with wrap the map repeats.
+    void setDepthColorRange(int nearPhase, int farPhase, bool wrap=false);
+    /// Mask noise in the depth texture: pixels with confidence below
+    /// minConfidence (measured as set by setConfidenceMode()) and, with
+    /// maskOutOfRange, pixels outside the setDepthColorRange() range take the
+    /// invalid colour. The mask is applied while decoding, at no extra pass.
+    void setDepthColorMask(unsigned short minConfidence, bool maskOutOfRange=false);
+    /// Colour of masked pixels and pixels without a measurement (default: white).
+    void setDepthInvalidColor(const ofColor &color);
+
+    /// Conversion of phase to the distance map's millimetres. The radial
+    /// distance is ((phase - phaseOffset - pixelOffset) mod 32768) * mmPerPhase;
+    /// with radialToZ it is then projected onto the optical axis. Pixels without
+    /// a measurement read 0.
+    struct DistanceCalibration {
+        /// Global phase offset, in phase units (32768 = 2 pi). The default,
+        /// -16384, puts the only wrap at the -pi/+pi cut of the measured
+        /// phase, so distance grows with phase across the whole range.
+        float phaseOffset;
+        /// Millimetres per phase unit, below 1 (default: 1 / 11.31032).
+        float mmPerPhase;
+        /// Report distance along the optical axis (Z) rather than along the ray (default: true).
+        bool radialToZ;
+        /// Depth camera intrinsics in depth pixels, for radialToZ (default:
+        /// from the nominal 74 x 58 degree field of view, centred).
+        float fx, fy, cx, cy;
+        /// Per-pixel fixed-pattern phase offsets, depth_width x depth_height
+        /// in row order, added to phaseOffset; empty for none.
+        vector<short> pixelOffsets;
+
+        DistanceCalibration();
+    };
+    void setDistanceCalibration(const DistanceCalibration &calibration);
+    const DistanceCalibration &getDistanceCalibration() const;
+    /// Load a calibration file and apply it. The file is whitespace-separated
+    /// text; each key is followed by its values, and '#' starts a comment:
+    ///     phase_offset <units>
+    ///     mm_per_phase <mm>
+    ///     radial_to_z <0 or 1>
+    ///     intrinsics <fx> <fy> <cx> <cy>
+    ///     pixel_offsets <depth_width x depth_height offsets in row order>
+    /// Keys left out keep their current values. Returns false (and changes
+    /// nothing) if the file can't be read.
+    bool loadDistanceCalibration(const string &path);
+    /// Read bytes of the camera's calibration ROM, for apps that know its layout
+    /// and want to fill a DistanceCalibration from it. Requires an open camera.
+    bool readCalibrationROM(unsigned char *buf, int address, int length);
+
+    /// Number of threads decoding MJPEG video frames (default: 0, decode on the
+    /// USB callback thread). With threads, the callback just queues each frame;
+    /// frames are decoded concurrently but still delivered in order, and frames
+    /// that are still waiting for a thread when a newer one arrives are dropped.
+    /// Changing this restarts the video stream.
+    void setVideoDecodeThreads(int numThreads);
+
 	/// Close the connection and stop grabbing images
 	void close();
 
@@ -114,12 +287,68 @@ public:
 	bool isFrameNew() { return isFrameNewVideo() || isFrameNewDepth(); }
 	bool isFrameNewVideo();
 	bool isFrameNewDepth();
+	bool isFrameSetNew();
 
 	/// Updates all enabled images and textures.
 	void update();
 
+	/// Block until a new depth (video) frame is ready for update(), or until
+	/// timeoutMillis have passed (negative: wait forever). Returns true
+	/// if a frame is ready; false on timeout, or if the stream is not
+	/// running or is stopped while waiting (by close(), or by disabling
+	/// it). Does not call update() itself.
+	bool waitForNextDepthFrame(int timeoutMillis=-1);
+	bool waitForNextVideoFrame(int timeoutMillis=-1);
+
 /// \section Pixel Data
 
+	/// Capture information for a frame
+	struct FrameInfo {
+		uint32_t sequence;  ///< device frame number
+		uint64_t timestamp; ///< estimated capture time, in microseconds since the Unix epoch
+	};
+
+	/// information about the frames behind the depth maps and the video texture
+	FrameInfo getDepthFrameInfo() const;
+	FrameInfo getVideoFrameInfo() const;
+
+	/// One decoded depth frame.
+	/// Maps are getDepthWidth() x getDepthHeight(); pointers are NULL for
+	/// depth outputs that are not enabled.
+	struct DepthFrameData {
+		FrameInfo info;
+		short *phase;
+		unsigned short *confidence;
+		unsigned short *distance;
+		short *rawIRI, *rawIRQ;
+	};
+
+	/// One decoded colour frame
+	struct VideoFrameData {
+		FrameInfo info;
+		unsigned char *pixels; ///< RGB or luma (getVideoChannels()), getVideoWidth() x getVideoHeight()
+	};
+
+	/// One compressed colour frame, exactly as sent by the camera
+	struct CompressedVideoFrame {
+		FrameInfo info;
+		const unsigned char *data; ///< JPEG data, usually without Huffman tables (DHT)
+		size_t size;               ///< 0 if the camera is not sending MJPEG
+	};
+
+	/// get the compressed frame behind the video pixels, as taken by update();
+	/// see enableCompressedVideo()
+	CompressedVideoFrame getCompressedVideoFrame() const;
+
+	/// A depth frame and the colour frame closest to it in time
+	struct FrameSet {
+		DepthFrameData depth;
+		VideoFrameData video;
+	};
+
+	/// get the newest frame set taken by update(); see enableFrameSets()
+	FrameSet getFrameSet();
+
     // raw phase values (-32768 = -2*pi)
 	short* getPhasePixels();
 
@@ -134,6 +363,9 @@ public:
     short *getRawIRIPixels();
     short *getRawIRQPixels();
 
+    // RGB (or grayscale) video, getVideoWidth() x getVideoHeight()
+    unsigned char *getVideoPixels();
+
 	/// get the video (RGB) texture
 	ofTexture& getVideoTextureRef();
 
@@ -143,27 +375,52 @@ public:
     ofTexture& getRawIRITextureRef();
     ofTexture& getRawIRQTextureRef();
 
+/// \section Listeners
+
+	/// Called from a worker thread as soon as a frame has arrived and been
+	/// decoded, independently of update(). The frame data is only valid until
+	/// the listener returns; copy out anything needed later.
+	///
+	/// Listeners run one at a time, in the order they were added, and should
+	/// return quickly: frames that arrive meanwhile replace each other and
+	/// only the newest is delivered next. Listeners must not call back into
+	/// ofxGestureCam.
+	typedef void (*DepthListener)(const DepthFrameData &frame, void *userdata);
+	typedef void (*VideoListener)(const VideoFrameData &frame, void *userdata);
+	typedef void (*CompressedVideoListener)(const CompressedVideoFrame &frame, void *userdata);
+
+	/// Adding a depth (video) listener will enable the depth (video) stream.
+	/// Removing a listener waits for any call to it in progress to return.
+	void addDepthListener(DepthListener listener, void *userdata=NULL);
+	void removeDepthListener(DepthListener listener, void *userdata=NULL);
+	void addVideoListener(VideoListener listener, void *userdata=NULL);
+	void removeVideoListener(VideoListener listener, void *userdata=NULL);
+	/// Compressed video listeners get the MJPEG frames without any decoding,
+	/// e.g. for recording. Adding one will enable the video stream.
+	void addCompressedVideoListener(CompressedVideoListener listener, void *userdata=NULL);
+	void removeCompressedVideoListener(CompressedVideoListener listener, void *userdata=NULL);
+
 /// \section Draw
 
 	/// draw the video texture
 	void drawVideo(float x, float y, float w, float h);
-	void drawVideo(float x, float y) { drawVideo(x, y, video_width, video_height); }
+	void drawVideo(float x, float y) { drawVideo(x, y, getVideoWidth(), getVideoHeight()); }
 	void drawVideo(const ofPoint& point) { drawVideo(point.x, point.y); }
 	void drawVideo(const ofRectangle& rect) { drawVideo(rect.x, rect.y, rect.width, rect.height); }
 
 	/// draw the colorized depth texture
 	void drawDepth(float x, float y, float w, float h);
-	void drawDepth(float x, float y) { drawDepth(x, y, depth_width, depth_height); }
+	void drawDepth(float x, float y) { drawDepth(x, y, getDepthWidth(), getDepthHeight()); }
 	void drawDepth(const ofPoint& point) { drawDepth(point.x, point.y); }
 	void drawDepth(const ofRectangle& rect) { drawDepth(rect.x, rect.y, rect.width, rect.height); }
 
 	void drawRawIRI(float x, float y, float w, float h);
-	void drawRawIRI(float x, float y) { drawRawIRI(x, y, depth_width, depth_height); }
+	void drawRawIRI(float x, float y) { drawRawIRI(x, y, getDepthWidth(), getDepthHeight()); }
 	void drawRawIRI(const ofPoint& point) { drawRawIRI(point.x, point.y); }
 	void drawRawIRI(const ofRectangle& rect) { drawRawIRI(rect.x, rect.y, rect.width, rect.height); }
 
 	void drawRawIRQ(float x, float y, float w, float h);
-	void drawRawIRQ(float x, float y) { drawRawIRQ(x, y, depth_width, depth_height); }
+	void drawRawIRQ(float x, float y) { drawRawIRQ(x, y, getDepthWidth(), getDepthHeight()); }
 	void drawRawIRQ(const ofPoint& point) { drawRawIRQ(point.x, point.y); }
 	void drawRawIRQ(const ofRectangle& rect) { drawRawIRQ(rect.x, rect.y, rect.width, rect.height); }
 
@@ -173,6 +430,31 @@ public:
 	/// returns an empty string "" if not connected
 	string getSerial() const;
 
+/// \section Statistics
+
+	/// Frame counters for one stream, accumulated since open() or resetStats().
+	///
+	/// usbGaps counts frames libuvc skipped (callback too slow or transfer
+	/// errors); a frame is dropped as invalid if invalid increases, and never
+	/// seen by the app if overwritten increases (update() is being called less
+	/// often than frames arrive). unpaired only counts while frame sets are
+	/// enabled.
+	struct StreamStats {
+		uint64_t received;    ///< frames delivered by the USB stack
+		uint64_t invalid;     ///< frames rejected as short or undecodable
+		uint64_t usbGaps;     ///< frames libuvc skipped (callback too slow or transfer errors)
+		uint64_t decoded;     ///< frames decoded into maps or pixels
+		uint64_t overwritten; ///< frames replaced by a newer one before update() took them
+		uint64_t consumed;    ///< frames taken by update()
+		uint64_t unpaired;    ///< frames left out of frame sets: the other stream's callback held
+		                      ///< the pairing lock, or (video) no depth frame was close enough
+	};
+
+	StreamStats getDepthStats() const;
+	StreamStats getVideoStats() const;
+	void resetStats();
+
+    /// Size of the default video mode
     const static int video_width = 1280;
     const static int video_height = 720;
     const static int depth_width = 320;
@@ -0,0 +1,218 @@
+/* fastatan2_accuracy.cpp, copyright (c) 2014 Robert Xiao
+
+Exhaustive accuracy check for FastAtan2, over every int16 (y, x) pair:
+
+- atan2Batch() stays within +/- 1 phase unit of the exact atan2(y, x) *
+  ATAN_SCALE, and its amplitudes are |y| + |x|;
+- atan2_16() stays within ATAN2_16_BOUND: its table index is truncated to
+  ATAN_BITS bits, which costs up to about 1 more unit;
+- cordicBatch() with the default iteration count stays within +/- 1 phase
+  unit, and within CORDIC_AMPLITUDE_BOUND of the exact sqrt(y^2 + x^2);
+- every instruction set compiled in (and supported by this CPU) gives
+  exactly the scalar results, except where NEON_TOLERANT() says otherwise:
+  the NEON polynomial divides (ARMv7: by reciprocal estimate), fuses and
+  rounds differently from the scalar code, so its atan2Batch() phases and
+  (on ARMv7) cordicBatch() amplitudes are only held to the accuracy bounds.
+
+Build and run from the addon directory (see README.md):
+    g++ -std=c++11 -Wall -Wextra -O2 -pthread -Isrc tests/fastatan2_accuracy.cpp -o fastatan2_accuracy && ./fastatan2_accuracy
+
+An optional argument checks only every n-th row of y, for a quicker run.
+Exits with status 1 if any check fails.
+*/
+
+#include "FastAtan2.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define PHASE_BOUND 1.0
+#define ATAN2_16_BOUND 2.1
+#define CORDIC_AMPLITUDE_BOUND 0.6
+
+static const int row_size = 65536;
+
+/* Outputs for which an ISA is checked against the accuracy bound only, not against the scalar kernel */
+#define NEON_TOLERANT(isa) ((isa) == FastAtan2::ISA_NEON)
+#if defined(__aarch64__)
+#define NEON_TOLERANT_ROUNDING(isa) false
+#else
+#define NEON_TOLERANT_ROUNDING(isa) NEON_TOLERANT(isa)
+#endif
+
+struct Result {
+    double maxError;
+    long failures;
+    long mismatches; /* differs from the scalar kernel */
+
+    Result() : maxError(0), failures(0), mismatches(0) {}
+
+    void add(double error, double bound) {
+        if(error > maxError)
+            maxError = error;
+        if(error > bound)
+            failures++;
+    }
+
+    void merge(const Result &other) {
+        maxError = std::max(maxError, other.maxError);
+        failures += other.failures;
+        mismatches += other.mismatches;
+    }
+};
+
+/* Per-ISA results of one thread */
+struct ISAResults {
+    Result batchPhase, batchAmplitude, cordicPhase, cordicAmplitude;
+
+    void merge(const ISAResults &other) {
+        batchPhase.merge(other.batchPhase);
+        batchAmplitude.merge(other.batchAmplitude);
+        cordicPhase.merge(other.cordicPhase);
+        cordicAmplitude.merge(other.cordicAmplitude);
+    }
+};
+
+static std::vector<FastAtan2::ISA> availableISAs() {
+    std::vector<FastAtan2::ISA> isas;
+    isas.push_back(FastAtan2::ISA_SCALAR);
+#ifdef GESTURECAM_HAVE_SSE2
+    isas.push_back(FastAtan2::ISA_SSE2);
+#endif
+#ifdef GESTURECAM_HAVE_AVX2
+    if(cpuHasAVX2())
+        isas.push_back(FastAtan2::ISA_AVX2);
+#endif
+#ifdef GESTURECAM_HAVE_NEON
+    isas.push_back(FastAtan2::ISA_NEON);
+#endif
+    return isas;
+}
+
+/* Phase error, allowing for the wrap at +/- pi */
+static double phaseError(int16_t phase, double exact) {
+    static const double half = fabs(M_PI * ATAN_SCALE);
+    double error = fabs(phase - exact);
+    if(error > half)
+        error = fabs(error - 2 * half);
+    return error;
+}
+
+/* Run a batch kernel over one row in two calls, so that both calls have vector tails */
+template <typename Fn> static void splitRow(int split, Fn fn) {
+    fn(0, split);
+    fn(split, row_size - split);
+}
+
+static void checkRows(const std::vector<FastAtan2::ISA> &isas, int stride, std::atomic<int> &nextRow,
+                      Result &atan16, std::vector<ISAResults> &results) {
+    FastAtan2 fastAtan;
+    std::vector<int16_t> y(row_size), x(row_size), phase(row_size), batchPhase(row_size), cordicPhase(row_size);
+    std::vector<uint16_t> amplitude(row_size), batchAmplitude(row_size), cordicAmplitude(row_size);
+    std::vector<double> exact(row_size), exactAmplitude(row_size);
+    for(int i=0; i<row_size; i++)
+        x[i] = i - 32768;
+
+    for(;;) {
+        int row = nextRow.fetch_add(stride);
+        if(row > 32767)
+            break;
+        std::fill(y.begin(), y.end(), (int16_t)row);
+        for(int i=0; i<row_size; i++) {
+            exact[i] = atan2((double)row, (double)x[i]) * ATAN_SCALE;
+            exactAmplitude[i] = sqrt((double)row * row + (double)x[i] * x[i]);
+            /* atan2(0, 0) is arbitrary (atan2_16 treats it as a diagonal) */
+            if(row != 0 || x[i] != 0)
+                atan16.add(phaseError(fastAtan.atan2_16(row, x[i]), exact[i]), ATAN2_16_BOUND);
+        }
+        int split = (row & 31) + 1;
+
+        for(size_t k=0; k<isas.size(); k++) {
+            ISAResults &r = results[k];
+            fastAtan.setISA(isas[k]);
+
+            splitRow(split, [&](int i, int n) {
+                fastAtan.atan2Batch(&y[i], &x[i], &phase[i], &amplitude[i], n);
+            });
+            /* The scalar kernel comes first, and is the reference for the others */
+            if(k == 0) {
+                batchPhase = phase;
+                batchAmplitude = amplitude;
+            }
+            for(int i=0; i<row_size; i++) {
+                r.batchPhase.add(phaseError(phase[i], exact[i]), PHASE_BOUND);
+                r.batchAmplitude.add(abs(amplitude[i] - (uint16_t)(abs(row) + abs(x[i]))), 0);
+                if(!NEON_TOLERANT(isas[k]))
+                    r.batchPhase.mismatches += (phase[i] != batchPhase[i]);
+                r.batchAmplitude.mismatches += (amplitude[i] != batchAmplitude[i]);
+            }
+
+            splitRow(split, [&](int i, int n) {
+                fastAtan.cordicBatch(&y[i], &x[i], &phase[i], &amplitude[i], n);
+            });
+            if(k == 0) {
+                cordicPhase = phase;
+                cordicAmplitude = amplitude;
+            }
+            for(int i=0; i<row_size; i++) {
+                /* As for atan2_16, skip atan2(0, 0) */
+                if(row != 0 || x[i] != 0)
+                    r.cordicPhase.add(phaseError(phase[i], exact[i]), PHASE_BOUND);
+                r.cordicAmplitude.add(fabs(amplitude[i] - exactAmplitude[i]), CORDIC_AMPLITUDE_BOUND);
+                r.cordicPhase.mismatches += (phase[i] != cordicPhase[i]);
+                if(!NEON_TOLERANT_ROUNDING(isas[k]))
+                    r.cordicAmplitude.mismatches += (amplitude[i] != cordicAmplitude[i]);
+            }
+        }
+    }
+}
+
+static bool report(const char *name, const char *isa, const Result &r) {
+    printf("%-22s %-6s  max error %.4f, over bound %ld, differs from scalar %ld\n",
+        name, isa, r.maxError, r.failures, r.mismatches);
+    return r.failures == 0 && r.mismatches == 0;
+}
+
+int main(int argc, char **argv) {
+    int stride = (argc > 1) ? atoi(argv[1]) : 1;
+    if(stride < 1)
+        stride = 1;
+
+    std::vector<FastAtan2::ISA> isas = availableISAs();
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<int> nextRow(-32768);
+    std::vector<Result> atan16(numThreads);
+    std::vector<std::vector<ISAResults> > results(numThreads, std::vector<ISAResults>(isas.size()));
+
+    std::vector<std::thread> threads;
+    for(int t=0; t<numThreads; t++)
+        threads.push_back(std::thread(checkRows, std::cref(isas), stride, std::ref(nextRow),
+            std::ref(atan16[t]), std::ref(results[t])));
+    for(size_t t=0; t<threads.size(); t++)
+        threads[t].join();
+
+    for(int t=1; t<numThreads; t++) {
+        atan16[0].merge(atan16[t]);
+        for(size_t k=0; k<isas.size(); k++)
+            results[0][k].merge(results[t][k]);
+    }
+
+    printf("Checked every x, and y from -32768 in steps of %d (%d threads)\n", stride, numThreads);
+    bool ok = report("atan2_16", "table", atan16[0]);
+    FastAtan2 fastAtan;
+    for(size_t k=0; k<isas.size(); k++) {
+        fastAtan.setISA(isas[k]);
+        const ISAResults &r = results[0][k];
+        ok &= report("atan2Batch phase", fastAtan.getISAName(), r.batchPhase);
+        ok &= report("atan2Batch amplitude", fastAtan.getISAName(), r.batchAmplitude);
+        ok &= report("cordicBatch phase", fastAtan.getISAName(), r.cordicPhase);
+        ok &= report("cordicBatch amplitude", fastAtan.getISAName(), r.cordicAmplitude);
+    }
+    printf(ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}